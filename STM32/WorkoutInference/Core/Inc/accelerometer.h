@@ -11,14 +11,70 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-// will have the x, y, z data in terms of g's
+// raw 12-bit counts straight off the sensor (right justified, sign extended),
+// at ±8g that's ACCEL_COUNTS_PER_G counts per g
 typedef struct {
-    float x;
-    float y;
-    float z;
+    int16_t x;
+    int16_t y;
+    int16_t z;
+    uint8_t flags;      // ACCEL_FLAG_*
+    uint32_t t_us;      // when the sensor converted it, Timebase_Micros() clock
 } AccelRawData;
 
+#define ACCEL_FLAG_REPEAT   0x01    // no new conversion since the last read, same data again
+#define ACCEL_FLAG_OVERRUN  0x02    // sensor overwrote a conversion we never read
+#define ACCEL_FLAG_LOST     0x04    // the read failed, x/y/z are the last good sample held over
+
+#define ACCEL_COUNTS_PER_G  256     // 2048 counts / 8g
+#define ACCEL_RAW_MIN       (-2048)
+#define ACCEL_RAW_COUNT     4096
+
+// how samples get pulled off the sensor
+#define ACCEL_ACQ_POLLED    0   // main loop reads every 10ms off HAL_GetTick
+#define ACCEL_ACQ_DRDY      1   // data ready interrupt, one read per conversion
+#define ACCEL_ACQ_FIFO      2   // FIFO stream mode, burst read on the watermark interrupt
+
+#ifndef ACCEL_ACQ_MODE
+#define ACCEL_ACQ_MODE      ACCEL_ACQ_DRDY
+#endif
+
+// reads run in the background on i2c_engine (irq driven + DMA1), kicked straight
+// from the INT1 irq into double buffered slots, so the CPU is free while the bus
+// is busy and a hung bus costs one sample instead of a 100ms timeout
+#ifndef ACCEL_USE_DMA
+#define ACCEL_USE_DMA       (ACCEL_ACQ_MODE != ACCEL_ACQ_POLLED)
+#endif
+
+#if ACCEL_USE_DMA && ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+#error "ACCEL_USE_DMA needs the INT1 interrupt, pick ACCEL_ACQ_DRDY or ACCEL_ACQ_FIFO"
+#endif
+
+// output data rate the sensor starts at, the model wants 100Hz and anything
+// else gets resampled to that (see resampler.c). 10, 25, 50, 100, 200 or 400
+#ifndef ACCEL_ODR_HZ
+#define ACCEL_ODR_HZ        100
+#endif
+
+// rate the sensor idles at while it's only watching for motion
+#define ACCEL_MOTION_ODR_HZ 10
+
+#define ACCEL_FIFO_DEPTH        32
+#define ACCEL_FIFO_WATERMARK    25  // samples per burst, 4 wakeups a second at 100Hz
+
 bool Accel_Init(void);
-void Accel_ReadRaw(AccelRawData *data);
+bool Accel_ReadRaw(AccelRawData *data);
+uint8_t Accel_ReadFifo(AccelRawData *data, uint8_t max);
+bool Accel_DataReady(void);
+bool Accel_SetODR(uint16_t hz);
+uint16_t Accel_GetODR(void);
+void Accel_ArmMotionWake(uint16_t threshold_mg);
+bool Accel_MotionWoke(void);
+void Accel_DisarmMotionWake(void);
+uint32_t Accel_GetMissedConversions(void);
+void Accel_ClockChanged(void);
+
+// called from the INT1 irq on every new conversion (every watermark in FIFO
+// mode), override it to line other sensors up with the accel
+void Accel_ConversionCallback(void);
 
 #endif
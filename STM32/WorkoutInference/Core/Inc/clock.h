@@ -0,0 +1,37 @@
+/* clock.h
+ * clock policy: sit on the bare 16MHz HSI (PLL off) for acquisition, which
+ * only needs a few hundred cycles a sample, and bring the PLL up to 100MHz
+ * just for the network's run
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef CLOCK_SCALING_ENABLE
+#define CLOCK_SCALING_ENABLE    1
+#endif
+
+#define CLOCK_LOW_HZ            16000000    // HSI, every bus undivided
+#define CLOCK_BOOST_HZ          100000000   // F411 max, HSI/8 * 200 / 4
+
+typedef enum {
+    CLOCK_LOW,
+    CLOCK_BOOST
+} ClockLevel;
+
+typedef struct {
+    uint32_t boosts;
+    uint32_t max_switch_us;     // worst transition, PLL lock included
+} ClockStats;
+
+void Clock_Init(void);
+void Clock_Boost(void);
+void Clock_Relax(void);
+void Clock_Restore(void);
+ClockLevel Clock_GetLevel(void);
+void Clock_GetStats(ClockStats *stats);
+
+#endif
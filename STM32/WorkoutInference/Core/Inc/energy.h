@@ -0,0 +1,63 @@
+/* energy.h
+ * where the active time goes, per pipeline stage, and what that comes to in
+ * current going by datasheet typicals. A model, not a measurement: good for
+ * comparing settings against each other, a meter on the board's IDD jumper
+ * is the real number
+ */
+
+#ifndef ENERGY_H
+#define ENERGY_H
+
+#include <stdint.h>
+
+#ifndef ENERGY_ACCOUNTING
+#define ENERGY_ACCOUNTING       1
+#endif
+
+// STM32F411 typicals at 25C (DS10314), code from flash with ART on and the
+// peripherals we don't use off. Run current goes roughly linear with SYSCLK
+#define ENERGY_RUN_STATIC_UA    670     // what's left at 0MHz on the run line
+#define ENERGY_RUN_UA_PER_MHZ   108     // ~2.4mA at 16MHz, ~11.5mA at 100MHz
+#define ENERGY_SLEEP_UA         1300    // Sleep at 16MHz, which is where we sleep
+#define ENERGY_STOP_UA          42      // Stop, low power regulator, flash powered down
+
+// the sensors, always on: LSM303DLHC accel at 100Hz normal mode, the L3GD20
+// on top if WORKOUT_USE_GYRO
+#define ENERGY_ACCEL_UA         110
+#define ENERGY_GYRO_UA          6100
+
+#define ENERGY_MAX_NESTING      4       // thread, PendSV, TIM3, one more for luck
+
+typedef enum {
+    ENERGY_SENSOR_IO,       // reading the sensor
+    ENERGY_QUANTIZE,        // resample, quantize, window in and out
+    ENERGY_NETWORK,         // ai_network_run
+    ENERGY_UART,            // printing
+    ENERGY_OTHER,           // awake but in none of the above
+    ENERGY_SLEEP,
+    ENERGY_STOP,
+    ENERGY_SENSORS,         // the sensor chips themselves
+    ENERGY_STAGES
+} EnergyStage;
+
+typedef struct {
+    uint32_t cycles[ENERGY_STAGES];     // active stages only
+    uint64_t charge_pc[ENERGY_STAGES];  // uA x us
+    uint32_t elapsed_us;
+    uint32_t avg_ua;                    // = uAh per hour of workout
+} EnergyReport;
+
+#if ENERGY_ACCOUNTING && !defined(HOST_BUILD)
+void Energy_Init(void);
+void Energy_Begin(EnergyStage stage);
+void Energy_End(void);
+void Energy_GetReport(EnergyReport *report);
+void Energy_ResetStats(void);
+#else
+#define Energy_Init()           ((void)0)
+#define Energy_Begin(stage)     ((void)(stage))
+#define Energy_End()            ((void)0)
+#define Energy_ResetStats()     ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,28 @@
+/* gyro.h
+ * L3GD20 (the on board gyro) driver for STM32, SPI1 with DMA
+ * setting up with 190Hz, ±500dps
+ */
+
+#ifndef GYRO_H
+#define GYRO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// raw 16-bit counts, 17.5 mdps per count at ±500dps
+typedef struct {
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} GyroRawData;
+
+#define GYRO_DPS_PER_COUNT  0.0175f
+
+bool Gyro_Init(void);
+void Gyro_StartRead(void);
+bool Gyro_Busy(void);
+bool Gyro_GetLatest(GyroRawData *data);
+uint32_t Gyro_GetMissedReads(void);
+void Gyro_SetPower(bool on);
+
+#endif
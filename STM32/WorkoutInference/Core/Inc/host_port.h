@@ -0,0 +1,59 @@
+/* host_port.h
+ * just enough of the HAL/CMSIS for main.c to build and run on a PC with
+ * -DHOST_BUILD, see host_port.c
+ */
+
+#ifndef HOST_PORT_H
+#define HOST_PORT_H
+
+#ifdef HOST_BUILD
+
+#include <stdint.h>
+
+void HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void Host_Idle(void);
+
+// no clocks to set up and no irqs to mask, WFI just gives the CPU back for a bit
+#define SystemClock_Config()    ((void)0)
+#define __disable_irq()         ((void)0)
+#define __enable_irq()          ((void)0)
+#define __WFI()                 Host_Idle()
+#define __get_PRIMASK()         0u
+#define __set_PRIMASK(m)        ((void)(m))
+
+// the DSP instructions the block quantizer uses, in plain C with the same
+// results bit for bit (bits is 1..16 like the real ones)
+static inline int32_t host_sat(int32_t v, int32_t lo, int32_t hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static inline uint32_t __USAT(int32_t v, uint32_t bits) {
+    return (uint32_t)host_sat(v, 0, (1 << bits) - 1);
+}
+
+static inline int32_t __SSAT(int32_t v, uint32_t bits) {
+    return host_sat(v, -(1 << (bits - 1)), (1 << (bits - 1)) - 1);
+}
+
+// each signed halfword on its own
+static inline uint32_t __USAT16(uint32_t v, uint32_t bits) {
+    uint32_t lo = __USAT((int16_t)v, bits);
+    uint32_t hi = __USAT((int16_t)(v >> 16), bits);
+    return lo | (hi << 16);
+}
+
+static inline uint32_t __SSAT16(uint32_t v, uint32_t bits) {
+    uint32_t lo = (uint16_t)__SSAT((int16_t)v, bits);
+    uint32_t hi = (uint16_t)__SSAT((int16_t)(v >> 16), bits);
+    return lo | (hi << 16);
+}
+
+// bottom half of a, top half of b shifted left
+static inline uint32_t __PKHBT(uint32_t a, uint32_t b, uint32_t shift) {
+    return (a & 0xFFFFu) | ((b << shift) & 0xFFFF0000u);
+}
+
+#endif
+
+#endif
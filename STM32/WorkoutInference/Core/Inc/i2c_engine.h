@@ -0,0 +1,38 @@
+/* i2c_engine.h
+ * interrupt driven register reads on I2C1 that never block the caller:
+ * every step is an irq, the data comes in over DMA, and each transaction
+ * has a hard time budget after which the bus gets reset and cleared
+ */
+
+#ifndef I2C_ENGINE_H
+#define I2C_ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// budget = base + per byte, ~2x what 400kHz actually takes. A 7 byte sample
+// read gets 850us, way under the 10ms sample period
+#define I2C_ENGINE_BUDGET_BASE_US   500
+#define I2C_ENGINE_BUDGET_BYTE_US   50
+
+// called from irq context when the transaction is done, ok = false if it
+// NAKed, errored out or ran past its budget
+typedef void (*I2CEngine_Done)(bool ok);
+
+typedef struct {
+    uint32_t completed;
+    uint32_t errors;        // NAK / arbitration lost / bus error
+    uint32_t timeouts;      // ran out of budget
+    uint32_t bus_clears;    // times we had to clock SCL to free a stuck slave
+} I2CEngineStats;
+
+void I2CEngine_Init(void);
+bool I2CEngine_Read(uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t len, I2CEngine_Done done);
+bool I2CEngine_Busy(void);
+void I2CEngine_GetStats(I2CEngineStats *stats);
+
+// hooked into stm32f4xx_it.c
+void I2CEngine_EventIRQ(void);
+void I2CEngine_ErrorIRQ(void);
+
+#endif
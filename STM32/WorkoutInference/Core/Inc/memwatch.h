@@ -0,0 +1,30 @@
+/* memwatch.h
+ * how much of the stack and heap reservations in the linker script actually
+ * get used. The free RAM gets painted at boot and scanned for the deepest
+ * the stack has been, _sbrk (sysmem.c) keeps track of the heap
+ */
+
+#ifndef MEMWATCH_H
+#define MEMWATCH_H
+
+#include <stdint.h>
+
+#define MEMWATCH_PAINT      0xA5A5A5A5u
+
+typedef struct {
+    uint32_t stack_used;        // deepest the stack has been, bytes down from _estack
+    uint32_t stack_reserved;    // _Min_Stack_Size
+    uint32_t heap_used;         // what _sbrk has handed out
+    uint32_t heap_reserved;     // _Min_Heap_Size
+    uint32_t heap_failures;     // _sbrk calls turned down, they'd have run into the stack
+    uint32_t untouched;         // RAM between the heap and the deepest stack use nobody's touched
+} MemStats;
+
+void Memwatch_PaintStack(void);
+void Memwatch_GetStats(MemStats *stats);
+
+// sysmem.c
+uint32_t Sysmem_HeapUsed(void);
+uint32_t Sysmem_HeapFailures(void);
+
+#endif
@@ -0,0 +1,28 @@
+/* motion.h
+ * decides when the wearer has gone still long enough to put everything to sleep,
+ * the accel's motion interrupt on INT1 wakes us back up
+ */
+
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "accelerometer.h"
+
+#ifndef MOTION_SLEEP_ENABLE
+#define MOTION_SLEEP_ENABLE         1
+#endif
+
+// how long with nothing moving before we Stop. Long enough to ride out a plank
+#ifndef MOTION_QUIET_MS
+#define MOTION_QUIET_MS             30000
+#endif
+
+#define MOTION_ACTIVE_MG            125 // deviation from the slow average that counts as moving
+#define MOTION_WAKE_THRESHOLD_MG    125 // same idea for the sensor's own interrupt (62mg steps)
+
+void Motion_Reset(void);
+bool Motion_Update(const AccelRawData *sample);
+
+#endif
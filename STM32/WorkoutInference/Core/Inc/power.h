@@ -0,0 +1,58 @@
+/* power.h
+ * what the MCU does while there's nothing to run: Sleep (just the core's clock
+ * gated, everything else keeps going) or Stop (every clock off until the
+ * accel's INT1 or a key on the terminal, then the clock level gets restored),
+ * and how long it actually spent awake
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "accelerometer.h"
+
+#define POWER_IDLE_SLEEP    0
+#define POWER_IDLE_STOP     1
+
+// Stop needs something outside the clock tree to wake us, which only the
+// interrupt driven acquisition modes have
+#ifndef POWER_IDLE_MODE
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+#define POWER_IDLE_MODE     POWER_IDLE_SLEEP
+#else
+#define POWER_IDLE_MODE     POWER_IDLE_STOP
+#endif
+#endif
+
+#if POWER_IDLE_MODE == POWER_IDLE_STOP && ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+#error "polled acquisition runs off SysTick, which Stop turns off. Use POWER_IDLE_SLEEP"
+#endif
+
+// USART2 goes down with the clocks in Stop, so a key typed then never makes it
+// into DR. The RX line's falling edge (PA3 on EXTI3) wakes us instead, and for
+// this long after any RX activity we only Sleep so the keys after it get read.
+// The key that does the waking is lost, its start bit came and went in Stop
+#ifndef POWER_RX_AWAKE_MS
+#define POWER_RX_AWAKE_MS   5000
+#endif
+
+typedef struct {
+    uint32_t sleeps;
+    uint32_t stops;
+    uint32_t elapsed_us;        // wall time these cover
+    uint64_t asleep_us;         // in Sleep or Stop
+    uint64_t stopped_us;        // the Stop part of that
+    uint32_t max_wake_us;       // Stop exit until the clocks are back, what each Stop costs
+} PowerStats;
+
+void Power_Init(void);
+uint32_t Power_Idle(void);
+void Power_StopUntil(bool (*woke)(void));
+void Power_GetStats(PowerStats *stats);
+void Power_ResetStats(void);
+
+// hooked into stm32f4xx_it.c
+void Power_RxWakeIRQ(void);
+
+#endif
@@ -0,0 +1,29 @@
+/* ramfunc.h
+ * RAMFUNC puts a function in .ramfunc, which the startup copies into SRAM
+ * along with the network's kernels and weights (see STM32F411VETX_FLASH.ld).
+ * Takes the flash wait states out of anything the ART cache misses on
+ */
+
+#ifndef RAMFUNC_H
+#define RAMFUNC_H
+
+// 0 leaves the tagged C functions in flash. The runtime kernels and the
+// weights are placed by the linker script, take that line out for those
+#ifndef WORKOUT_RAMFUNC
+#define WORKOUT_RAMFUNC     1
+#endif
+
+// 1 prints what ended up in RAM at boot
+#ifndef RAMFUNC_REPORT
+#define RAMFUNC_REPORT      0
+#endif
+
+#if WORKOUT_RAMFUNC && !defined(HOST_BUILD)
+#define RAMFUNC             __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+void RamFunc_Report(void);
+
+#endif
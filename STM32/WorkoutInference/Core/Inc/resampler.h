@@ -0,0 +1,34 @@
+/* resampler.h
+ * fixed point polyphase L/M resampler, gets any sensor ODR onto the
+ * model's 100Hz stream
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "accelerometer.h"
+
+#define RESAMPLER_TAPS_PER_RATE     8   // prototype length = 8 * max(L, M)
+#define RESAMPLER_MAX_TAPS          80  // 10 -> 100Hz is the worst case (L = 10)
+#define RESAMPLER_MAX_PHASE_TAPS    32  // 400 -> 100Hz (M = 4, one phase)
+#define RESAMPLER_MAX_OUT           10  // most outputs one input can make (L / M rounded up)
+
+typedef struct {
+    uint8_t L;              // upsample
+    uint8_t M;              // downsample
+    uint8_t phase_taps;     // taps per phase
+    uint8_t phase;          // where the next output sits, in upsampled ticks
+    uint8_t head;
+    bool bypass;            // in == out, just copy through
+    int16_t coef[RESAMPLER_MAX_TAPS];  // Q15, grouped by phase: coef[p * phase_taps + k]
+    // history twice over so every phase is one straight run, no wrapping
+    int16_t hist[3][2 * RESAMPLER_MAX_PHASE_TAPS];
+} Resampler;
+
+bool Resampler_Init(Resampler *rs, uint16_t in_hz, uint16_t out_hz);
+void Resampler_Reset(Resampler *rs);
+uint8_t Resampler_Push(Resampler *rs, const AccelRawData *in, AccelRawData *out);
+
+#endif
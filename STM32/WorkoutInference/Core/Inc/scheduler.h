@@ -0,0 +1,56 @@
+/* scheduler.h
+ * little run-to-completion scheduler. TIM3 ticks at 1kHz and releases the
+ * periodic tasks, sensors release theirs through a ready() check, and the
+ * CPU sits in WFI whenever nothing is released.
+ * Normal tasks run from the TIM3 irq, deferred ones from PendSV underneath
+ * them so they can be preempted. On each level tasks run in the order they
+ * were added, first one is the most urgent.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS         8
+#define SCHED_TICK_HZ           1000
+#define SCHED_IRQ_PRIORITY      3   // under the sensor irqs, a late tick only delays a release
+#define SCHED_DEFERRED_PRIORITY 15  // PendSV, lowest there is
+
+typedef struct {
+    uint32_t runs;
+    uint32_t deadline_misses;   // finished more than deadline_us after its release
+    uint32_t overruns;          // released again before the last release got to run
+    uint32_t max_latency_us;    // release -> start
+    uint32_t max_run_us;
+    uint64_t total_run_us;
+} SchedTaskStats;
+
+typedef struct SchedTask {
+    // filled in by whoever owns the task
+    const char *name;
+    void (*run)(void);
+    bool (*ready)(void);        // polled before each sleep, NULL if it's only released by period/Scheduler_Release
+    uint32_t period_ms;         // 0 = not periodic
+    uint32_t deadline_us;       // release to finish budget
+    bool deferred;              // runs from PendSV, anything else preempts it
+
+    // scheduler's
+    volatile bool released;
+    volatile uint32_t release_us;
+    uint32_t next_tick;
+    SchedTaskStats stats;
+} SchedTask;
+
+void Scheduler_Init(void);
+void Scheduler_ClockChanged(void);
+bool Scheduler_Add(SchedTask *task);
+bool Scheduler_Release(SchedTask *task);
+void Scheduler_Poll(void);
+void Scheduler_ResetStats(void);
+uint32_t Scheduler_StatsElapsedUs(void);
+void Scheduler_TickIRQ(void);
+void Scheduler_DeferredIRQ(void);
+
+#endif
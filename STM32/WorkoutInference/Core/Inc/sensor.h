@@ -0,0 +1,52 @@
+/* sensor.h
+ * where the accel samples come from. main only talks to a SensorBackend, so
+ * the same acquisition -> window -> inference loop runs off the LSM303 on the
+ * board or off a recorded CSV on a PC (see sensor_replay.c)
+ */
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "accelerometer.h"
+
+#define SENSOR_BACKEND_LSM303   0   // the on board accel, accelerometer.c
+#define SENSOR_BACKEND_REPLAY   1   // a recorded WatchAccelerometerUncalibrated.csv, host builds only
+
+#ifndef SENSOR_BACKEND
+#define SENSOR_BACKEND          SENSOR_BACKEND_LSM303
+#endif
+
+#if SENSOR_BACKEND == SENSOR_BACKEND_REPLAY && !defined(HOST_BUILD)
+#error "the replay backend reads a file, build it on the host with -DHOST_BUILD"
+#endif
+
+// most samples one read() can hand back
+#if SENSOR_BACKEND == SENSOR_BACKEND_LSM303 && ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+#define SENSOR_MAX_BURST        ACCEL_FIFO_DEPTH
+#else
+#define SENSOR_MAX_BURST        1
+#endif
+
+typedef struct {
+    const char *name;
+    bool (*init)(void);
+    bool (*data_ready)(void);                           // something to read, never blocks
+    uint8_t (*read)(AccelRawData *data, uint8_t max);   // up to max samples, returns how many
+    uint16_t (*get_odr)(void);                          // Hz, what the window gets resampled from
+    bool (*set_odr)(uint16_t hz);                       // NULL if the rate's fixed
+    uint32_t (*get_missed)(void);                       // samples it knows it dropped
+    bool (*finished)(void);                             // NULL if it never runs out
+} SensorBackend;
+
+extern const SensorBackend sensor_lsm303;
+extern const SensorBackend sensor_replay;
+
+#if SENSOR_BACKEND == SENSOR_BACKEND_REPLAY
+#define SENSOR_DEFAULT          (&sensor_replay)
+#else
+#define SENSOR_DEFAULT          (&sensor_lsm303)
+#endif
+
+#endif
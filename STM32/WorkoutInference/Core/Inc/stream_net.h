@@ -0,0 +1,30 @@
+/* stream_net.h
+ * the network evaluated one sample at a time: each new sample's depthwise and
+ * pointwise convs get computed once, the max-pool blocks and the mean's sum
+ * are kept running, so a classification costs a few hundred cycles instead of
+ * a whole window's worth. Same integer math as the generated network (scales,
+ * zero points and weights out of X-CUBE-AI/App), checked against it by
+ * Workout_RunInference every WORKOUT_STREAM_CHECK_HOPS
+ */
+
+#ifndef STREAM_NET_H
+#define STREAM_NET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "workout_inference.h"
+
+#define STREAM_POOL         HOP_STEP_SAMPLES            // max-pool size and stride
+#define STREAM_BLOCKS       (BUFFER_SIZE / STREAM_POOL) // pool outputs the mean goes over
+#define STREAM_CHANNELS     8                           // pointwise conv outputs
+
+bool StreamNet_Init(void);
+void StreamNet_Reset(void);
+void StreamNet_Push(const uint8_t codes[3]);
+bool StreamNet_Ready(void);
+void StreamNet_Classify(uint8_t out[NUM_CLASSES]);
+#ifdef HOST_BUILD
+void StreamNet_RunWindow(const uint8_t window[][NUM_FEATURES], uint8_t out[NUM_CLASSES]);
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+/* telemetry.h
+ * the real time health of the pipeline on one line: samples that went
+ * missing, work that ran late, the worst wait to get going and how long
+ * printing held things up. Cumulative since the stats were last reset, so
+ * two summaries a while apart say whether a change made things worse
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include "scheduler.h"
+
+// how often the summary gets printed on its own, 0 = only when asked ('t')
+#ifndef TELEMETRY_PERIOD_MS
+#define TELEMETRY_PERIOD_MS     10000
+#endif
+
+typedef struct {
+    uint32_t samples_missed;    // gaps, overruns, lost reads and whatever the driver counted
+    uint32_t acquire_late;      // sample reads that came later than the sensor could hold them
+    uint32_t infer_late;        // inferences that finished after the next hop was due, or got their window overrun
+    uint32_t hops_skipped;
+    uint32_t max_latency_us;    // worst release -> start of acquire or infer
+    uint32_t uart_blocked_us;   // spinning on a full UART
+    uint32_t elapsed_us;
+} TelemetrySummary;
+
+void Telemetry_Init(const SchedTask *acquire, const SchedTask *infer, uint32_t (*driver_missed)(void));
+void Telemetry_Get(TelemetrySummary *summary);
+void Telemetry_Print(void);
+void Telemetry_Reset(void);
+
+#endif
@@ -0,0 +1,30 @@
+/* timebase.h
+ * free running microsecond clock off TIM2 (32 bit, wraps every ~71 minutes),
+ * plus a one shot alarm on compare channel 1
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+#ifndef HOST_BUILD
+#include "stm32f4xx.h"
+#endif
+
+#define TIMEBASE_IRQ_PRIORITY   2   // same level as the sensor irqs that arm the alarm
+
+void Timebase_Init(void);
+void Timebase_SetAlarm(uint32_t at_us, void (*callback)(void));
+void Timebase_CancelAlarm(void);
+void Timebase_AlarmIRQ(void);
+
+#ifdef HOST_BUILD
+uint32_t Timebase_Micros(void);     // host_port.c
+#else
+// safe from irqs, unsigned subtraction handles the wrap
+static inline uint32_t Timebase_Micros(void) {
+    return TIM2->CNT;
+}
+#endif
+
+#endif
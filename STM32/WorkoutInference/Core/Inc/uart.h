@@ -9,8 +9,10 @@
 #define UART_H
 
 #include <stdint.h>
+#ifndef HOST_BUILD
 #include "stm32f4xx.h"
 #include "stm32f4xx_hal.h"
+#endif
 
 // ansi color codes
 #define ANSI_RESET       "\x1b[0m"
@@ -20,7 +22,11 @@
 #define ANSI_BLUE_BOLD   "\x1b[1;34m"
 #define ANSI_CYAN_BOLD   "\x1b[1;36m"
 
+#define UART_BAUD        115200
+
 void UART_Init(void);
+void UART_ClockChanged(void);
+uint32_t UART_GetBlockedUs(void);
 int getchar_nonblocking(void);
 int getchar_polled(void);
 void putchar_polled(int c);
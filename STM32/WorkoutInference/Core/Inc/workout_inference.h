@@ -9,11 +9,79 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "accelerometer.h"
+#include "gyro.h"
 
-#define SAMPLE_RATE_HZ      100
+#define SAMPLE_RATE_HZ      100 // what the model was trained on, sensor gets resampled to this
 #define WINDOW_SIZE_SEC     2
 #define BUFFER_SIZE         (SAMPLE_RATE_HZ * WINDOW_SIZE_SEC)  // 200 samples
+
+// classify with the streaming version of the network (stream_net.c) instead
+// of running the generated one over the whole window every hop. Each sample's
+// conv outputs get computed once as it comes in, so a hop costs next to
+// nothing and can be as short as one max-pool block (50ms)
+#ifndef WORKOUT_STREAMING
+#define WORKOUT_STREAMING   0
+#endif
+
+// streaming still runs the generated network on every Nth hop's window (every
+// 5s at the default hop, so the two together cost about what one network run
+// a second did) and counts where they disagree, 0 never runs it
+#ifndef WORKOUT_STREAM_CHECK_HOPS
+#define WORKOUT_STREAM_CHECK_HOPS   100
+#endif
+
+// how far the window slides between inferences, counted in samples at
+// SAMPLE_RATE_HZ. Anything from one sample (10ms) to the whole window (2s),
+// shorter means a new exercise shows up sooner but more network runs
+#ifndef WORKOUT_HOP_MS
+#if WORKOUT_STREAMING
+#define WORKOUT_HOP_MS      50
+#else
+#define WORKOUT_HOP_MS      1000
+#endif
+#endif
+#define HOP_MIN_MS          (1000 / SAMPLE_RATE_HZ)
+#define HOP_MAX_MS          (WINDOW_SIZE_SEC * 1000)
+
+// streaming can only classify windows that start on a max-pool block
+#if WORKOUT_STREAMING
+#define HOP_STEP_SAMPLES    5
+#else
+#define HOP_STEP_SAMPLES    1
+#endif
+
+#if WORKOUT_HOP_MS < HOP_MIN_MS || WORKOUT_HOP_MS > HOP_MAX_MS
+#error "WORKOUT_HOP_MS has to be between one sample and the whole window"
+#endif
+#if (WORKOUT_HOP_MS * SAMPLE_RATE_HZ / 1000) % HOP_STEP_SAMPLES
+#error "streaming hops have to be whole max-pool blocks (multiples of 50ms)"
+#endif
+
+// window and hop kept in .noinit RAM through a watchdog or soft reset, so
+// inference picks up again within a hop instead of after a 2s refill
+#ifndef WORKOUT_WARM_RESTART
+#ifdef HOST_BUILD
+#define WORKOUT_WARM_RESTART    0
+#else
+#define WORKOUT_WARM_RESTART    1
+#endif
+#endif
+// 6 axis variant, gyro x/y/z go in after the accel ones. Needs a network
+// trained on 6 channels (checked against network.h in workout_inference.c)
+#ifndef WORKOUT_USE_GYRO
+#define WORKOUT_USE_GYRO    0
+#endif
+
+#if WORKOUT_USE_GYRO
+#define NUM_FEATURES        6   // x, y, z, gx, gy, gz
+#else
 #define NUM_FEATURES        3   // x, y, z
+#endif
+
+#if WORKOUT_USE_GYRO && ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+#error "gyro reads pair up with single accel conversions, use ACCEL_ACQ_DRDY or ACCEL_ACQ_POLLED"
+#endif
 #define NUM_CLASSES         6
 
 // Quantization params from TFLite model, we quantized to uint8
@@ -22,6 +90,41 @@
 #define OUTPUT_QUANT_SCALE 0.093426f
 #define OUTPUT_QUANT_ZERO  101
 
+// what the network's input is:
+// 0: uint8, the model as exported so far. Its graph opens with conversion_0,
+//    1200 MACC spent turning our codes into int8 before conv2d_2
+// 1: int8, exported with INT8_INPUT in cnn_uint8_2_seconds.py, the graph starts
+//    right at conv2d_2. Same scale, the zero point's just 128 lower, so the
+//    codes are the uint8 ones with the top bit flipped
+#ifndef WORKOUT_INPUT_INT8
+#define WORKOUT_INPUT_INT8  0
+#endif
+
+#if WORKOUT_INPUT_INT8
+#define INPUT_CODE_FLIP     0x80
+#else
+#define INPUT_CODE_FLIP     0x00
+#endif
+
+// gyro input quantization, placeholder (±500dps across the uint8 range)
+// until the 6 axis model is exported, then copy its params in here
+#define GYRO_QUANT_SCALE   3.92f
+#define GYRO_QUANT_ZERO    128
+
+// block quantizer (Workout_QuantizeBlock): samples quantized per pass in a
+// straight through burst, 3 bytes of stack each
+#define QUANT_BLOCK         32
+
+// 1 checks the block quantizer against the table for every raw count at init,
+// ~10ms on the low clock so it's on by default only off the board
+#ifndef WORKOUT_QUANT_CHECK
+#ifdef HOST_BUILD
+#define WORKOUT_QUANT_CHECK 1
+#else
+#define WORKOUT_QUANT_CHECK 0
+#endif
+#endif
+
 // Workout class labels, based on the training order
 typedef enum {
     WORKOUT_WEIGHTLIFT = 0,
@@ -32,27 +135,82 @@ typedef enum {
     WORKOUT_JUMP_ROPE = 5
 } WorkoutClass;
 
-// Circular buffer for accelerometer data
+// where the network's input comes from:
+// 0: a mirrored ring the network reads in place, no copying but the window's
+//    kept twice over (1500 bytes)
+// 1: a plain ring of just the window (600 bytes), copied at each snapshot into
+//    the input tensor the runtime already has inside its activations
+#ifndef WORKOUT_INPUT_IN_ACTIVATIONS
+#define WORKOUT_INPUT_IN_ACTIVATIONS    0
+#endif
+
+#if WORKOUT_INPUT_IN_ACTIVATIONS
+#define RING_SLACK          0   // the network has its own copy, nothing to protect
+#define RING_SAMPLES        BUFFER_SIZE
+#define RING_ROWS           RING_SAMPLES
+#else
+// samples that can come in while the network is still reading a window
+// before they start overwriting its oldest ones
+#define RING_SLACK          50
+#define RING_SAMPLES        (BUFFER_SIZE + RING_SLACK)
+#define RING_ROWS           (2 * RING_SAMPLES)
+#endif
+
+// Circular buffer for accelerometer data in the network's [time][feature]
+// order. Mirrored (WORKOUT_INPUT_IN_ACTIVATIONS 0): every sample goes in at
+// write_idx and again at write_idx + RING_SAMPLES, so the newest BUFFER_SIZE
+// samples are always one straight run and get handed to it as they are
 typedef struct {
-    uint8_t x[BUFFER_SIZE];
-    uint8_t y[BUFFER_SIZE];
-    uint8_t z[BUFFER_SIZE];
+    uint8_t data[RING_ROWS][NUM_FEATURES];
     uint16_t write_idx;
-    bool is_full;
+    uint16_t filled;        // up to BUFFER_SIZE
 } AccelBuffer;
 
+// how well the incoming samples keep time, all on the sensor side of the resampler.
+// jitter is each sample interval minus the nominal ODR period
+#define JITTER_HIST_BINS    8   // |jitter| <50us, <100, <250, <500, <1ms, <2.5ms, <5ms, more
+
+typedef struct {
+    uint32_t samples;           // fresh samples taken in
+    uint32_t repeats;           // reads that got the same conversion again (dropped)
+    uint32_t overruns;          // sensor said it overwrote one we never read
+    uint32_t lost;              // bus failed, held the last value in its place
+    uint32_t gap_missed;        // conversions missing going by the timestamps
+    uint32_t driver_missed;     // what the sensor backend itself counted, main fills it in
+    uint32_t hops_skipped;      // hops that went by while the network was still on an older one
+    uint32_t windows_overrun;   // RING_SLACK samples came in mid inference, result thrown out
+    uint32_t stream_checks;     // streaming results the generated network was run against
+    uint32_t stream_mismatches; // of those, ones where any score came out different
+    int32_t jitter_min_us;
+    int32_t jitter_max_us;
+    uint32_t jitter_hist[JITTER_HIST_BINS];
+} SampleStats;
+
 // result struct for inference
 typedef struct {
     WorkoutClass predicted_class;
     float confidence;
     float class_scores[NUM_CLASSES];
     uint32_t inference_time_ms;
+    uint32_t inference_cycles;  // ai_network_run alone, or StreamNet_Classify streaming
     uint32_t timestamp;
 } WorkoutResult;
 
 bool Workout_Init(void);
-void Workout_AddSample(float x, float y, float z);
+bool Workout_WarmStarted(void);
+void Workout_AddSample(const AccelRawData *sample);
+void Workout_AddSamples(const AccelRawData *samples, uint16_t count);
+void Workout_QuantizeBlock(const AccelRawData *samples, uint8_t codes[][3], uint16_t count);
+bool Workout_CheckQuantizer(void);
+bool Workout_SetInputRate(uint16_t hz);
+void Workout_SetGyro(const GyroRawData *gyro);
+void Workout_GetSampleStats(SampleStats *stats);
+void Workout_ResetSampleStats(void);
+bool Workout_SetHop(uint16_t ms);
+uint16_t Workout_GetHopMs(void);
 bool Workout_ShouldInfer(void);
+bool Workout_Snapshot(void);
+bool Workout_NetworkDue(void);
 bool Workout_RunInference(WorkoutResult *result);
 const char* Workout_GetName(WorkoutClass cls);
 void Workout_ResetBuffer(void);
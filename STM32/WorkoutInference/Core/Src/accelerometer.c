@@ -1,28 +1,128 @@
 
 /* accelerometer.c
  * LSM303DLHC (the on board accelerometer) driver for STM32
- * setting up with 100Hz, ±8g, high-res
+ * setting up with 100Hz (or ACCEL_ODR_HZ), ±8g, high-res
  * Daphne Felt - ECEN 5613
  */
 
 #include "accelerometer.h"
 #include "stm32f4xx_hal.h"
+#include "main.h"
 #include "uart.h"
+#include "timebase.h"
+#include "i2c_engine.h"
 
 #define LSM303_ADDR             (0x19 << 1)  // 0x32 after shift
 
 // registers
 #define CTRL_REG1_A             0x20
+#define CTRL_REG2_A             0x21
+#define CTRL_REG3_A             0x22
 #define CTRL_REG4_A             0x23
+#define CTRL_REG5_A             0x24
+#define REFERENCE_A             0x26
+#define STATUS_REG_A            0x27
 #define OUT_X_L_A               0x28
+#define FIFO_CTRL_REG_A         0x2E
+#define FIFO_SRC_REG_A          0x2F
+#define INT1_CFG_A              0x30
+#define INT1_SRC_A              0x31
+#define INT1_THS_A              0x32
+#define INT1_DURATION_A         0x33
 
 // again, setting to fixed config. These are the hard-coded vals
-#define CTRL1_100HZ_ENABLED     0x57 // 100Hz, all axes enabled
+#define CTRL1_XYZ_EN            0x07 // all axes enabled, ODR goes in the top nibble
 #define CTRL4_8G_HIGHRES_BDU    0xA8 // ±8g, high-res, BDU enabled
+#define CTRL3_I1_DRDY1          0x10 // accel data ready on INT1
+#define CTRL3_I1_WTM            0x04 // FIFO watermark on INT1
+#define CTRL3_I1_AOI1           0x40 // inertial interrupt 1 on INT1
+#define CTRL5_FIFO_EN           0x40
+#define CTRL5_LIR_INT1          0x08 // latch INT1 until INT1_SRC_A gets read
+#define CTRL2_HPIS1             0x01 // high pass (gravity out) on the interrupt 1 path
+#define INT1_CFG_XYZ_HIGH       0x2A // OR of X/Y/Z high events
+#define INT1_THS_MG_PER_LSB     62   // at ±8g
+#define FIFO_MODE_STREAM        0x80 // FM = 10, keeps the newest 32 when full
+#define FIFO_SRC_OVRN           0x40
+#define FIFO_SRC_FSS_MASK       0x1F
+#define STATUS_ZYXDA            0x08 // new x/y/z since the last read
+#define STATUS_ZYXOR            0x80 // ...and one got overwritten before that
+
+// single sample reads start one register early at STATUS_REG_A, so we know
+// if it's fresh: status, X_L, X_H, Y_L, Y_H, Z_L, Z_H
+#define STATUS_SAMPLE_BYTES     7
 
 #define I2C_TIMEOUT             100
+#define ACCEL_IRQ_PRIORITY      2   // under SysTick so HAL timeouts still tick inside the irqs, same as i2c_engine
+
+// setup/config writes go through the blocking HAL calls on this, sample
+// reads (in the irq modes) through i2c_engine so they never block
 static I2C_HandleTypeDef hi2c1;
 
+// bumped by the EXTI callback, one per finished conversion (or watermark in FIFO mode)
+static volatile uint32_t drdy_pending = 0;
+static volatile uint32_t missed_conversions = 0;
+static uint16_t odr_hz = ACCEL_ODR_HZ;
+
+// Timebase_Micros() at the last INT1 edge, and the stamp for the sample main reads next
+static volatile uint32_t int1_time_us = 0;
+static uint32_t sample_time_us = 0;
+static AccelRawData last_good;    // what a lost sample gets filled in with
+
+// while armed INT1 is the motion interrupt, the EXTI only flags a wakeup
+static volatile bool motion_armed = false;
+static volatile bool motion_woke = false;
+
+// CTRL_REG1_A ODR field, normal/high-res mode rates only
+static const struct {
+    uint16_t hz;
+    uint8_t code;
+} odr_table[] = {
+    {10, 0x2}, {25, 0x3}, {50, 0x4}, {100, 0x5}, {200, 0x6}, {400, 0x7}
+};
+
+// 0 if the sensor can't do that rate
+static uint8_t odr_code(uint16_t hz) {
+    for (uint8_t i = 0; i < sizeof(odr_table) / sizeof(odr_table[0]); i++) {
+        if (odr_table[i].hz == hz) {
+            return odr_table[i].code;
+        }
+    }
+    return 0;
+}
+
+#if ACCEL_USE_DMA
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+// FIFO_SRC goes first so we know how many are queued (and whether it
+// overran), then however many that is. The engine wants 2 bytes minimum, the
+// second one is INT1_CFG_A and just gets ignored
+#define SLOT_REG                OUT_X_L_A
+#define SLOT_BYTES              (ACCEL_FIFO_DEPTH * 6)
+#define FIFO_SRC_READ_BYTES     2
+static uint8_t fifo_src[FIFO_SRC_READ_BYTES];
+#else
+#define SLOT_REG                STATUS_REG_A
+#define SLOT_BYTES              STATUS_SAMPLE_BYTES
+#endif
+
+// double buffered: DMA fills one slot while main copies out of the other
+static uint8_t dma_slots[2][SLOT_BYTES];
+static uint8_t slot_samples[2];
+static uint32_t slot_time_us[2];
+static bool slot_lost[2];
+static volatile uint8_t fill_slot = 0;
+static volatile int8_t ready_slot = -1;   // -1 = nothing new
+static volatile bool dma_busy = false;
+
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+// set when Accel_DataReady re-kicks a read off the level instead of an edge,
+// int1_time_us is then just when we noticed
+static volatile bool int1_rekick = false;
+static bool slot_from_edge;
+#endif
+#endif
+
+static uint8_t read_fifo_blocking(AccelRawData *data, uint8_t max);
+
 static void init_i2c(void) {
     __HAL_RCC_I2C1_CLK_ENABLE();
     __HAL_RCC_GPIOB_CLK_ENABLE();
@@ -47,6 +147,10 @@ static void init_i2c(void) {
     hi2c1.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
 
     HAL_I2C_Init(&hi2c1); // built in func they give you
+
+#if ACCEL_USE_DMA
+    I2CEngine_Init();
+#endif
 }
 
 static inline void write_reg(uint8_t reg, uint8_t val) {
@@ -54,10 +158,72 @@ static inline void write_reg(uint8_t reg, uint8_t val) {
                       I2C_MEMADD_SIZE_8BIT, &val, 1, I2C_TIMEOUT);
 }
 
-static inline void read_regs(uint8_t reg, uint8_t *buf, uint8_t len) {
+static inline bool read_regs(uint8_t reg, uint8_t *buf, uint8_t len) {
     reg |= 0x80;  // auto increment
-    HAL_I2C_Mem_Read(&hi2c1, LSM303_ADDR, reg,
-                     I2C_MEMADD_SIZE_8BIT, buf, len, I2C_TIMEOUT);
+    return HAL_I2C_Mem_Read(&hi2c1, LSM303_ADDR, reg,
+                            I2C_MEMADD_SIZE_8BIT, buf, len, I2C_TIMEOUT) == HAL_OK;
+}
+
+// The LSM303DLHC's DRDY pin (PE2) is the magnetometer's data ready, the accel
+// one (DRDY1) and the FIFO watermark only come out on INT1, so that's the line
+// we listen on (PE4)
+static void init_int1_irq(void) {
+    __HAL_RCC_GPIOE_CLK_ENABLE();
+
+    GPIO_InitTypeDef gpio = {0};
+    gpio.Pin = INT1_Pin;
+    gpio.Mode = GPIO_MODE_IT_RISING;
+    gpio.Pull = GPIO_NOPULL;
+    HAL_GPIO_Init(INT1_GPIO_Port, &gpio);
+
+    // same priority as the I2C/DMA irqs so they never step on each other's handle
+    HAL_NVIC_SetPriority(EXTI4_IRQn, ACCEL_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+}
+
+// keep the INT1 irq (and with it any new DMA read) off the bus so we can do blocking writes
+static void hold_bus(void) {
+    HAL_NVIC_DisableIRQ(EXTI4_IRQn);
+#if ACCEL_USE_DMA
+    uint32_t start = HAL_GetTick();
+    while (dma_busy && HAL_GetTick() - start < I2C_TIMEOUT) {}
+#endif
+}
+
+static void release_bus(void) {
+#if ACCEL_ACQ_MODE != ACCEL_ACQ_POLLED
+    HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+#endif
+}
+
+// routes DRDY1 / the FIFO watermark to INT1 and flushes whatever was sitting there
+static void start_acquisition(void) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_DRDY
+    write_reg(CTRL_REG5_A, 0);
+    write_reg(CTRL_REG3_A, CTRL3_I1_DRDY1);
+#elif ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+    // stream mode, INT1 goes up once ACCEL_FIFO_WATERMARK samples are queued
+    write_reg(CTRL_REG5_A, CTRL5_FIFO_EN);
+    write_reg(FIFO_CTRL_REG_A, FIFO_MODE_STREAM | ACCEL_FIFO_WATERMARK);
+    write_reg(CTRL_REG3_A, CTRL3_I1_WTM);
+#else
+    write_reg(CTRL_REG5_A, 0);
+    write_reg(CTRL_REG3_A, 0);
+#endif
+
+    HAL_Delay(10);
+
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_DRDY
+    // INT1 may already be sitting high from a conversion we never read,
+    // a dummy read drops it so the next one gives us a clean rising edge
+    uint8_t dummy[STATUS_SAMPLE_BYTES];
+    read_regs(STATUS_REG_A, dummy, STATUS_SAMPLE_BYTES);
+#elif ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+    // same idea, throw away whatever queued up while we were configuring
+    AccelRawData dummy[ACCEL_FIFO_DEPTH];
+    read_fifo_blocking(dummy, ACCEL_FIFO_DEPTH);
+#endif
+    drdy_pending = 0;
 }
 
 bool Accel_Init(void) {
@@ -73,29 +239,391 @@ bool Accel_Init(void) {
     }
 
     // config
-    write_reg(CTRL_REG1_A, CTRL1_100HZ_ENABLED);
+    uint8_t code = odr_code(odr_hz);
+    if (code == 0) {
+        sendString("ACCEL ODR NOT SUPPORTED\n\r");
+        return false;
+    }
+    write_reg(CTRL_REG1_A, (code << 4) | CTRL1_XYZ_EN);
     write_reg(CTRL_REG4_A, CTRL4_8G_HIGHRES_BDU);
 
-    HAL_Delay(10);
+    init_int1_irq();
+    HAL_NVIC_DisableIRQ(EXTI4_IRQn);  // not until the sensor's set up
+    start_acquisition();
+    release_bus();
+    return true;
+}
+
+// swap INT1 over to the inertial (motion) interrupt: sensor drops to
+// ACCEL_MOTION_ODR_HZ, gravity gets high passed off the interrupt path and any
+// axis moving more than threshold_mg raises INT1. Main can Stop the MCU after this
+void Accel_ArmMotionWake(uint16_t threshold_mg) {
+    hold_bus();
+    write_reg(CTRL_REG3_A, 0);
+    write_reg(CTRL_REG5_A, CTRL5_LIR_INT1);  // FIFO off too
+    write_reg(CTRL_REG1_A, (odr_code(ACCEL_MOTION_ODR_HZ) << 4) | CTRL1_XYZ_EN);
+    write_reg(CTRL_REG2_A, CTRL2_HPIS1);
+
+    uint8_t ths = threshold_mg / INT1_THS_MG_PER_LSB;
+    if (ths == 0) ths = 1;
+    if (ths > 0x7F) ths = 0x7F;
+    write_reg(INT1_THS_A, ths);
+    write_reg(INT1_DURATION_A, 0);
+    write_reg(INT1_CFG_A, INT1_CFG_XYZ_HIGH);
+
+    // reading REFERENCE_A snaps the high pass to where we are now, and INT1_SRC_A clears the latch
+    uint8_t dummy;
+    read_regs(REFERENCE_A, &dummy, 1);
+    read_regs(INT1_SRC_A, &dummy, 1);
+
+    motion_woke = false;
+    motion_armed = true;
+    write_reg(CTRL_REG3_A, CTRL3_I1_AOI1);
+    __HAL_GPIO_EXTI_CLEAR_IT(INT1_Pin);
+    HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+}
+
+// true once the motion interrupt has fired since arming
+bool Accel_MotionWoke(void) {
+    return motion_woke;
+}
+
+// back to normal sampling at the old ODR
+void Accel_DisarmMotionWake(void) {
+    HAL_NVIC_DisableIRQ(EXTI4_IRQn);
+    motion_armed = false;
+
+    uint8_t dummy;
+    write_reg(CTRL_REG3_A, 0);
+    write_reg(INT1_CFG_A, 0);
+    read_regs(INT1_SRC_A, &dummy, 1);
+    write_reg(CTRL_REG2_A, 0);
+    write_reg(CTRL_REG1_A, (odr_code(odr_hz) << 4) | CTRL1_XYZ_EN);
+
+    start_acquisition();
+    __HAL_GPIO_EXTI_CLEAR_IT(INT1_Pin);
+    release_bus();
+}
+
+// true once per sensor conversion (per watermark in FIFO mode), consumes the pending irq
+bool Accel_DataReady(void) {
+#if ACCEL_USE_DMA
+    if (ready_slot >= 0) {
+        return true;
+    }
+    // same stuck-high story as below, but the read has to be kicked from the
+    // irq so the HAL handle only ever gets touched at one priority
+    if (!dma_busy && HAL_GPIO_ReadPin(INT1_GPIO_Port, INT1_Pin) == GPIO_PIN_SET) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+        int1_rekick = true;
+#endif
+        EXTI->SWIER = INT1_Pin;
+    }
+    return false;
+#elif ACCEL_ACQ_MODE != ACCEL_ACQ_POLLED
+    // caller may already have irqs masked (main does, around its WFI)
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t pending = drdy_pending;
+    drdy_pending = 0;
+    __set_PRIMASK(primask);
+
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_DRDY
+    if (pending > 1) {
+        missed_conversions += pending - 1;
+    }
+#endif
+
+    // DRDY1/WTM are levels, if we were late reading the line never went low
+    // so there was no new edge. Still high means there's data waiting
+    if (pending > 0) {
+        sample_time_us = int1_time_us;
+    } else if (HAL_GPIO_ReadPin(INT1_GPIO_Port, INT1_Pin) == GPIO_PIN_SET) {
+        sample_time_us = Timebase_Micros();  // no edge to go by, best we've got
+        pending = 1;
+    }
+    return pending > 0;
+#else
     return true;
+#endif
 }
 
-void convert_to_gs(AccelRawData *data){
-	data->x = (data->x * 8.0f) / 2048.0f;
-	data->y = (data->y * 8.0f) / 2048.0f;
-	data->z = (data->z * 8.0f) / 2048.0f;
+// switch the sensor's output data rate on the fly, false if the rate isn't one it does.
+// main only calls it through set_odr, which moves the resampler and acquire's deadline with it
+bool Accel_SetODR(uint16_t hz) {
+    uint8_t code = odr_code(hz);
+    if (code == 0) {
+        return false;
+    }
+
+    hold_bus();
+    write_reg(CTRL_REG1_A, (code << 4) | CTRL1_XYZ_EN);
+    odr_hz = hz;
+    release_bus();
+    return true;
 }
 
-// read all vals
-void Accel_ReadRaw(AccelRawData *data) {
-    uint8_t buf[6];
+uint16_t Accel_GetODR(void) {
+    return odr_hz;
+}
 
-    read_regs(OUT_X_L_A, buf, 6); // X_L, X_H, Y_L, Y_H, Z_L, Z_H
+// I2C timing (FREQ, CCR, TRISE) comes from PCLK1, redo it after clock.c
+// changes that. Only call it with the bus idle
+void Accel_ClockChanged(void) {
+    HAL_I2C_Init(&hi2c1);
+}
 
+uint32_t Accel_GetMissedConversions(void) {
+    return missed_conversions;
+}
+
+#if ACCEL_USE_DMA
+// i2c_engine is done with the slot (irq context)
+static void read_done(bool ok) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+    if (!ok) {
+        // samples are still queued in the sensor and WTM stays high, so
+        // Accel_DataReady kicks another read. Nothing lost yet
+        dma_busy = false;
+        return;
+    }
+#endif
+    // a failed single read means that conversion is gone (the next one
+    // overwrites it), hand main a slot that says so instead of skipping it
+    slot_lost[fill_slot] = !ok;
+    if (ready_slot >= 0) {
+        // main never picked up the previous slot, it gets overwritten next time round
+        missed_conversions += slot_samples[fill_slot ^ 1];
+    }
+    ready_slot = fill_slot;
+    fill_slot ^= 1;
+    dma_busy = false;
+}
+
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+// FIFO_SRC is in (irq context), chain the burst read for what it says is queued
+static void fifo_src_done(bool ok) {
+    if (!ok) {
+        dma_busy = false;  // WTM's still high, Accel_DataReady tries again
+        return;
+    }
+
+    // same accounting as read_fifo_blocking: FSS tops out at 31, overrun
+    // means all 32 are full and the oldest is gone
+    uint8_t src = fifo_src[0];
+    uint8_t count = src & FIFO_SRC_FSS_MASK;
+    if (src & FIFO_SRC_OVRN) {
+        count = ACCEL_FIFO_DEPTH;
+        missed_conversions++;
+    }
+    if (count == 0) {
+        dma_busy = false;
+        return;
+    }
+
+    // WTM goes up as the watermark'th sample lands, so off a real edge that
+    // one converted at int1_time_us and any past it came a period apart after.
+    // A re-kick or an overrun leaves no edge to go by, the newest converted
+    // within a period of now
+    uint32_t period_us = 1000000 / odr_hz;
+    uint32_t newest_us = Timebase_Micros();
+    if (slot_from_edge && !(src & FIFO_SRC_OVRN) && count >= ACCEL_FIFO_WATERMARK) {
+        newest_us = int1_time_us + (uint32_t)(count - ACCEL_FIFO_WATERMARK) * period_us;
+    }
+    slot_time_us[fill_slot] = newest_us;
+    slot_samples[fill_slot] = count;
+
+    if (!I2CEngine_Read(LSM303_ADDR, SLOT_REG | 0x80, dma_slots[fill_slot], count * 6, read_done)) {
+        dma_busy = false;
+    }
+}
+#endif
+
+// kicks the background read into the free slot, irq context only
+static void start_dma_read(void) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+    // a busy bus or a failed start loses nothing here, it all stays queued
+    // and the OVRN bit says if it ever came to that
+    bool from_edge = !int1_rekick;
+    int1_rekick = false;
+    if (dma_busy) {
+        return;
+    }
+    dma_busy = true;
+    slot_from_edge = from_edge;
+    if (!I2CEngine_Read(LSM303_ADDR, FIFO_SRC_REG_A | 0x80, fifo_src, FIFO_SRC_READ_BYTES, fifo_src_done)) {
+        dma_busy = false;
+    }
+#else
+    if (dma_busy) {
+        // last transfer still on the bus, this conversion is gone
+        missed_conversions++;
+        return;
+    }
+    dma_busy = true;
+    slot_time_us[fill_slot] = int1_time_us;
+    slot_samples[fill_slot] = 1;
+    if (!I2CEngine_Read(LSM303_ADDR, SLOT_REG | 0x80, dma_slots[fill_slot], SLOT_BYTES, read_done)) {
+        dma_busy = false;
+        missed_conversions++;
+    }
+#endif
+}
+
+// copies the finished slot out (and when its newest sample converted),
+// returns how many samples are in it, 0 if there wasn't one
+static uint8_t take_slot(uint8_t *buf, uint32_t *t_us, bool *lost) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int8_t slot = ready_slot;
+    uint8_t count = 0;
+    if (slot >= 0) {
+        count = slot_samples[slot];
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+        uint16_t bytes = count * 6;
+#else
+        uint16_t bytes = SLOT_BYTES;
+#endif
+        for (uint16_t i = 0; i < bytes; i++) {
+            buf[i] = dma_slots[slot][i];
+        }
+        *t_us = slot_time_us[slot];
+        *lost = slot_lost[slot];
+        ready_slot = -1;
+    }
+    __set_PRIMASK(primask);
+    return count;
+}
+#endif
+
+__weak void Accel_ConversionCallback(void) {
+}
+
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin) {
+    if (GPIO_Pin == INT1_Pin) {
+        if (motion_armed) {
+            motion_woke = true;
+            return;
+        }
+        int1_time_us = Timebase_Micros();
+        Accel_ConversionCallback();
+#if ACCEL_USE_DMA
+        start_dma_read();
+#else
+        drdy_pending++;
+#endif
+    }
+}
+
+// X_L, X_H, Y_L, Y_H, Z_L, Z_H -> one sample
+// stays in raw counts, the g scaling is folded into workout_inference's lookup table
+static void unpack_sample(const uint8_t *buf, AccelRawData *data) {
     // Combine bytes
     data->x = (int16_t)((buf[1] << 8) | buf[0]) >> 4;
     data->y = (int16_t)((buf[3] << 8) | buf[2]) >> 4;
     data->z = (int16_t)((buf[5] << 8) | buf[4]) >> 4;
+    data->flags = 0;
+}
+
+// status byte first, then the usual 6
+static void unpack_status_sample(const uint8_t *buf, AccelRawData *data) {
+    unpack_sample(&buf[1], data);
+    if (!(buf[0] & STATUS_ZYXDA)) {
+        data->flags |= ACCEL_FLAG_REPEAT;
+    }
+    if (buf[0] & STATUS_ZYXOR) {
+        data->flags |= ACCEL_FLAG_OVERRUN;
+    }
+}
+
+// read all vals. false if there was nothing to read (DMA slot not in yet),
+// a failed bus read still hands back a sample, flagged lost
+bool Accel_ReadRaw(AccelRawData *data) {
+    uint8_t buf[STATUS_SAMPLE_BYTES];
+    uint32_t t_us;
+
+#if ACCEL_USE_DMA && ACCEL_ACQ_MODE == ACCEL_ACQ_DRDY
+    // already on the MCU, just copy it out
+    bool lost;
+    if (!take_slot(buf, &t_us, &lost)) {
+        return false;
+    }
+#else
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_DRDY
+    t_us = sample_time_us;
+#else
+    t_us = Timebase_Micros();
+#endif
+    bool lost = !read_regs(STATUS_REG_A, buf, STATUS_SAMPLE_BYTES); // STATUS, X_L, X_H, Y_L, Y_H, Z_L, Z_H
+#endif
+    if (lost) {
+        // bus failed on this one, hold the last value so the window keeps its timing
+        *data = last_good;
+        data->flags = ACCEL_FLAG_LOST;
+        data->t_us = t_us;
+        return true;
+    }
+    unpack_status_sample(buf, data);
+    data->t_us = t_us;
+    last_good = *data;
+    return true;
+}
 
-    convert_to_gs(data);
+// FIFO reads only tell us when the newest one landed, the rest go back one ODR period each
+static void stamp_burst(AccelRawData *data, uint8_t count, uint32_t newest_us) {
+    uint32_t period_us = 1000000 / odr_hz;
+    for (uint8_t i = 0; i < count; i++) {
+        data[i].t_us = newest_us - (uint32_t)(count - 1 - i) * period_us;
+    }
+}
+
+// drain everything queued in the FIFO with one burst, returns how many samples
+static uint8_t read_fifo_blocking(AccelRawData *data, uint8_t max) {
+    uint8_t src;
+    read_regs(FIFO_SRC_REG_A, &src, 1);
+
+    // FSS tops out at 31, overrun means all 32 slots are full and we lost the oldest
+    uint8_t count = src & FIFO_SRC_FSS_MASK;
+    if (src & FIFO_SRC_OVRN) {
+        count = ACCEL_FIFO_DEPTH;
+        missed_conversions++;
+    }
+    if (count > max) {
+        count = max;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // with the FIFO on, auto increment wraps from OUT_Z_H_A back to OUT_X_L_A,
+    // so one long read walks down the queue
+    uint8_t buf[ACCEL_FIFO_DEPTH * 6];
+    uint32_t t_us = Timebase_Micros();
+    read_regs(OUT_X_L_A, buf, count * 6);
+
+    for (uint8_t i = 0; i < count; i++) {
+        unpack_sample(&buf[i * 6], &data[i]);
+    }
+    stamp_burst(data, count, t_us);
+    return count;
+}
+
+uint8_t Accel_ReadFifo(AccelRawData *data, uint8_t max) {
+#if ACCEL_USE_DMA && ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+    // the background read grabbed whatever FIFO_SRC said was queued
+    uint8_t buf[SLOT_BYTES];
+    uint32_t t_us;
+    bool lost;  // never set here, failed FIFO reads just get retried
+    uint8_t count = take_slot(buf, &t_us, &lost);
+    if (count > max) {
+        count = max;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        unpack_sample(&buf[i * 6], &data[i]);
+    }
+    stamp_burst(data, count, t_us);
+    return count;
+#else
+    return read_fifo_blocking(data, max);
+#endif
 }
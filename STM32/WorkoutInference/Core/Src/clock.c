@@ -0,0 +1,155 @@
+/* clock.c
+ * switches SYSCLK between the bare HSI and the PLL, and retimes everything
+ * that derives a rate from the bus clocks: TIM2 (timebase), TIM3 (scheduler
+ * tick), USART2 BRR, I2C1 FREQ/CCR/TRISE. SysTick gets redone by
+ * HAL_RCC_ClockConfig itself. SPI1 (gyro) stays on /16, that's 1MHz low and
+ * 6.25MHz boosted, both fine for the chip.
+ *
+ * A switch waits for the I2C engine, the gyro read and the UART to be idle,
+ * then runs with irqs masked so nobody touches a peripheral halfway retimed.
+ * Going up includes the PLL lock, ~100-200us, a sample landing in there just
+ * gets its irq (and timestamp) that much late.
+ */
+
+#include "clock.h"
+#include "main.h"
+#include "timebase.h"
+#include "scheduler.h"
+#include "uart.h"
+#include "accelerometer.h"
+#include "i2c_engine.h"
+#include "gyro.h"
+#include "workout_inference.h"
+
+static volatile ClockLevel level = CLOCK_BOOST;    // well, SystemClock_Config's 96MHz until Clock_Init
+static ClockStats stats;
+
+static bool transfer_busy(void) {
+#if ACCEL_USE_DMA
+    if (I2CEngine_Busy()) {
+        return true;
+    }
+#endif
+#if WORKOUT_USE_GYRO
+    if (Gyro_Busy()) {
+        return true;
+    }
+#endif
+    return !(USART2->SR & USART_SR_TC);
+}
+
+static void set_low(void) {
+    RCC_ClkInitTypeDef clk = {0};
+    clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+    clk.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+    clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    clk.APB1CLKDivider = RCC_HCLK_DIV1;
+    clk.APB2CLKDivider = RCC_HCLK_DIV1;
+    HAL_RCC_ClockConfig(&clk, FLASH_LATENCY_0);
+
+    // nothing's running off the PLL any more, turn it off (the regulator drops
+    // to scale 3 by itself with it off)
+    RCC_OscInitTypeDef osc = {0};
+    osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    osc.PLL.PLLState = RCC_PLL_OFF;
+    HAL_RCC_OscConfig(&osc);
+}
+
+static void set_boost(void) {
+    // VOS only sticks while the PLL is off, which it is here
+    __HAL_RCC_PWR_CLK_ENABLE();
+    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
+
+    RCC_OscInitTypeDef osc = {0};
+    osc.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    osc.PLL.PLLState = RCC_PLL_ON;
+    osc.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+    osc.PLL.PLLM = 8;
+    osc.PLL.PLLN = 200;
+    osc.PLL.PLLP = RCC_PLLP_DIV4;
+    osc.PLL.PLLQ = 8;   // no USB, doesn't matter that it isn't 48
+    HAL_RCC_OscConfig(&osc);
+
+    RCC_ClkInitTypeDef clk = {0};
+    clk.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+    clk.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    clk.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    clk.APB1CLKDivider = RCC_HCLK_DIV2;     // APB1 tops out at 50MHz
+    clk.APB2CLKDivider = RCC_HCLK_DIV1;
+    HAL_RCC_ClockConfig(&clk, FLASH_LATENCY_3);
+}
+
+static void retime_peripherals(void) {
+    Timebase_Init();
+    Scheduler_ClockChanged();
+    UART_ClockChanged();
+    Accel_ClockChanged();
+}
+
+static void switch_to(ClockLevel to) {
+#if CLOCK_SCALING_ENABLE
+    uint32_t primask;
+    for (;;) {
+        while (transfer_busy()) {}
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (!transfer_busy()) {
+            break;
+        }
+        __set_PRIMASK(primask);  // something snuck in, let it finish
+    }
+
+    if (level != to) {
+        uint32_t start = Timebase_Micros();
+        if (to == CLOCK_BOOST) {
+            set_boost();
+            stats.boosts++;
+        } else {
+            set_low();
+        }
+        retime_peripherals();
+        level = to;
+
+        uint32_t took = Timebase_Micros() - start;
+        if (took > stats.max_switch_us) {
+            stats.max_switch_us = took;
+        }
+    }
+    __set_PRIMASK(primask);
+#else
+    (void)to;
+#endif
+}
+
+// after SystemClock_Config and all the peripheral inits, drops to the low clock
+void Clock_Init(void) {
+    switch_to(CLOCK_LOW);
+}
+
+void Clock_Boost(void) {
+    switch_to(CLOCK_BOOST);
+}
+
+void Clock_Relax(void) {
+    switch_to(CLOCK_LOW);
+}
+
+// coming out of Stop we're on the HSI with the bus dividers untouched, which
+// already is the low level. Boosted, the PLL has to come back
+void Clock_Restore(void) {
+#if CLOCK_SCALING_ENABLE
+    if (level == CLOCK_BOOST) {
+        set_boost();
+    }
+#else
+    SystemClock_Config();
+#endif
+}
+
+ClockLevel Clock_GetLevel(void) {
+    return level;
+}
+
+void Clock_GetStats(ClockStats *out) {
+    *out = stats;
+}
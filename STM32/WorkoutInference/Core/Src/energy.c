@@ -0,0 +1,104 @@
+/* energy.c
+ * active time is counted in core cycles off the DWT, which stops along with
+ * the core in Sleep and Stop, so only awake time ends up in the stages. The
+ * stages nest (acquire preempting a network run) and a cycle only counts
+ * for the innermost one, so nothing's counted twice.
+ * Each chunk is charged at the run current for whatever SYSCLK was when it
+ * ended, clock.c switches in between stages so that's close enough
+ */
+
+#include "energy.h"
+
+#if ENERGY_ACCOUNTING
+
+#include "stm32f4xx.h"
+#include "power.h"
+#include "workout_inference.h"
+#include <string.h>
+
+#if WORKOUT_USE_GYRO
+#define SENSORS_UA  (ENERGY_ACCEL_UA + ENERGY_GYRO_UA)
+#else
+#define SENSORS_UA  ENERGY_ACCEL_UA
+#endif
+
+static uint8_t stack[ENERGY_MAX_NESTING];
+static uint8_t depth = 0;
+static uint32_t mark;       // CYCCNT when the running stage last got charged
+static uint32_t cycles[ENERGY_STAGES];
+static uint64_t charge_pc[ENERGY_STAGES];
+
+// everything since mark goes to whatever's on top, irqs masked by the caller
+static void charge(void) {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t n = now - mark;
+    mark = now;
+
+    uint8_t stage = depth ? stack[depth - 1] : ENERGY_OTHER;
+    uint32_t mhz = SystemCoreClock / 1000000;
+    cycles[stage] += n;
+    charge_pc[stage] += (uint64_t)n * (ENERGY_RUN_STATIC_UA + ENERGY_RUN_UA_PER_MHZ * mhz) / mhz;
+}
+
+void Energy_Init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    Energy_ResetStats();
+}
+
+void Energy_Begin(EnergyStage stage) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    charge();
+    if (depth < ENERGY_MAX_NESTING) {
+        stack[depth] = stage;
+    }
+    depth++;    // even past the end, so the Ends still line up
+    __set_PRIMASK(primask);
+}
+
+void Energy_End(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    charge();
+    if (depth) {
+        depth--;
+    }
+    __set_PRIMASK(primask);
+}
+
+// the active stages as counted, idle and the sensors worked out from how long
+// we were asleep for, over the same stretch the power stats cover
+void Energy_GetReport(EnergyReport *out) {
+    PowerStats power;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    charge();
+    memcpy(out->cycles, cycles, sizeof(cycles));
+    memcpy(out->charge_pc, charge_pc, sizeof(charge_pc));
+    Power_GetStats(&power);
+    __set_PRIMASK(primask);
+
+    out->charge_pc[ENERGY_SLEEP] = (power.asleep_us - power.stopped_us) * ENERGY_SLEEP_UA;
+    out->charge_pc[ENERGY_STOP] = power.stopped_us * ENERGY_STOP_UA;
+    out->charge_pc[ENERGY_SENSORS] = (uint64_t)power.elapsed_us * SENSORS_UA;
+    out->elapsed_us = power.elapsed_us;
+
+    uint64_t total = 0;
+    for (uint8_t i = 0; i < ENERGY_STAGES; i++) {
+        total += out->charge_pc[i];
+    }
+    out->avg_ua = power.elapsed_us ? (uint32_t)(total / power.elapsed_us) : 0;
+}
+
+// goes with Power_ResetStats, the two have to cover the same time
+void Energy_ResetStats(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(cycles, 0, sizeof(cycles));
+    memset(charge_pc, 0, sizeof(charge_pc));
+    mark = DWT->CYCCNT;
+    __set_PRIMASK(primask);
+}
+
+#endif
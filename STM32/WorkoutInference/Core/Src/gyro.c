@@ -0,0 +1,207 @@
+/* gyro.c
+ * L3GD20 (the on board gyro) driver for STM32, SPI1 with DMA
+ * setting up with 190Hz, ±500dps
+ *
+ * The gyro runs faster than the accel and we don't use its own data ready.
+ * Instead a read gets kicked off right when the accel has a new sample
+ * (Gyro_StartRead from the INT1 irq), so each accel sample is paired with
+ * the gyro's newest one, at most one gyro period (~5ms) older
+ */
+
+#include "gyro.h"
+#include "stm32f4xx_hal.h"
+#include "main.h"
+#include "uart.h"
+
+// registers
+#define WHO_AM_I                0x0F
+#define CTRL_REG1               0x20
+#define CTRL_REG4               0x23
+#define OUT_X_L                 0x28
+
+#define SPI_READ                0x80
+#define SPI_AUTO_INC            0x40
+
+#define WHO_AM_I_L3GD20         0xD4
+#define WHO_AM_I_I3G4250D       0xD3 // newer board revisions ship this one, same registers
+#define CTRL1_190HZ_ENABLED     0x6F // 190Hz, 50Hz bandwidth, powered, all axes
+#define CTRL1_POWER_DOWN        0x60 // same rate bits, PD cleared
+#define CTRL4_500DPS_BDU        0x90 // ±500dps, BDU enabled
+
+#define SPI_TIMEOUT             100
+#define GYRO_IRQ_PRIORITY       2   // same as the accel irqs, which kick our reads
+
+// not static, the irq handlers in stm32f4xx_it.c need them
+SPI_HandleTypeDef hspi1;
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
+
+// command byte + 6 data bytes, the first rx byte is junk
+static uint8_t tx_buf[7];
+static uint8_t rx_buf[7];
+
+static volatile bool read_busy = false;
+static volatile bool have_sample = false;
+static GyroRawData latest;
+static volatile uint32_t missed_reads = 0;
+
+static inline void cs_low(void) {
+    HAL_GPIO_WritePin(CS_I2C_SPI_GPIO_Port, CS_I2C_SPI_Pin, GPIO_PIN_RESET);
+}
+
+static inline void cs_high(void) {
+    HAL_GPIO_WritePin(CS_I2C_SPI_GPIO_Port, CS_I2C_SPI_Pin, GPIO_PIN_SET);
+}
+
+static void init_spi(void) {
+    __HAL_RCC_GPIOE_CLK_ENABLE();
+
+    // PE3 = CS, idle high (also keeps the chip in SPI mode instead of I2C)
+    GPIO_InitTypeDef gpio = {0};
+    gpio.Pin = CS_I2C_SPI_Pin;
+    gpio.Mode = GPIO_MODE_OUTPUT_PP;
+    gpio.Pull = GPIO_NOPULL;
+    gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+    HAL_GPIO_Init(CS_I2C_SPI_GPIO_Port, &gpio);
+    cs_high();
+
+    // SPI1, mode 3, 48MHz APB2 / 16 = 3MHz (chip tops out at 10)
+    // the SCK/MISO/MOSI pins get set up in HAL_SPI_MspInit
+    hspi1.Instance = SPI1;
+    hspi1.Init.Mode = SPI_MODE_MASTER;
+    hspi1.Init.Direction = SPI_DIRECTION_2LINES;
+    hspi1.Init.DataSize = SPI_DATASIZE_8BIT;
+    hspi1.Init.CLKPolarity = SPI_POLARITY_HIGH;
+    hspi1.Init.CLKPhase = SPI_PHASE_2EDGE;
+    hspi1.Init.NSS = SPI_NSS_SOFT;
+    hspi1.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16;
+    hspi1.Init.FirstBit = SPI_FIRSTBIT_MSB;
+    hspi1.Init.TIMode = SPI_TIMODE_DISABLE;
+    hspi1.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+    hspi1.Init.CRCPolynomial = 10;
+    HAL_SPI_Init(&hspi1);
+
+    // SPI1 RX = DMA2 stream 0 ch 3, TX = DMA2 stream 3 ch 3
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    hdma_spi1_rx.Instance = DMA2_Stream0;
+    hdma_spi1_rx.Init.Channel = DMA_CHANNEL_3;
+    hdma_spi1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_spi1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_spi1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_spi1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_spi1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_spi1_rx.Init.Mode = DMA_NORMAL;
+    hdma_spi1_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_spi1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    HAL_DMA_Init(&hdma_spi1_rx);
+    __HAL_LINKDMA(&hspi1, hdmarx, hdma_spi1_rx);
+
+    hdma_spi1_tx.Instance = DMA2_Stream3;
+    hdma_spi1_tx.Init = hdma_spi1_rx.Init;
+    hdma_spi1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    HAL_DMA_Init(&hdma_spi1_tx);
+    __HAL_LINKDMA(&hspi1, hdmatx, hdma_spi1_tx);
+
+    HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, GYRO_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+    HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, GYRO_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+    HAL_NVIC_SetPriority(SPI1_IRQn, GYRO_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(SPI1_IRQn);
+}
+
+// blocking, setup and power switching only
+static void write_reg(uint8_t reg, uint8_t val) {
+    uint8_t buf[2] = {reg, val};
+    cs_low();
+    HAL_SPI_Transmit(&hspi1, buf, 2, SPI_TIMEOUT);
+    cs_high();
+}
+
+static uint8_t read_reg(uint8_t reg) {
+    uint8_t tx[2] = {reg | SPI_READ, 0};
+    uint8_t rx[2] = {0};
+    cs_low();
+    HAL_SPI_TransmitReceive(&hspi1, tx, rx, 2, SPI_TIMEOUT);
+    cs_high();
+    return rx[1];
+}
+
+bool Gyro_Init(void) {
+    sendString("INITIALIZING GYRO");
+    init_spi();
+
+    uint8_t id = read_reg(WHO_AM_I);
+    if (id != WHO_AM_I_L3GD20 && id != WHO_AM_I_I3G4250D) {
+        sendString("GYRO CONNECTION FAILED\n\r");
+        return false;
+    }
+
+    write_reg(CTRL_REG4, CTRL4_500DPS_BDU);
+    write_reg(CTRL_REG1, CTRL1_190HZ_ENABLED);
+
+    tx_buf[0] = OUT_X_L | SPI_READ | SPI_AUTO_INC;
+    return true;
+}
+
+// kicks off a background read of all 3 axes, fine to call from an irq
+void Gyro_StartRead(void) {
+    if (read_busy) {
+        missed_reads++;
+        return;
+    }
+    read_busy = true;
+    cs_low();
+    if (HAL_SPI_TransmitReceive_DMA(&hspi1, tx_buf, rx_buf, sizeof(rx_buf)) != HAL_OK) {
+        cs_high();
+        read_busy = false;
+        missed_reads++;
+    }
+}
+
+// a read's on the bus right now
+bool Gyro_Busy(void) {
+    return read_busy;
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi != &hspi1) {
+        return;
+    }
+    cs_high();
+    latest.x = (int16_t)((rx_buf[2] << 8) | rx_buf[1]);
+    latest.y = (int16_t)((rx_buf[4] << 8) | rx_buf[3]);
+    latest.z = (int16_t)((rx_buf[6] << 8) | rx_buf[5]);
+    have_sample = true;
+    read_busy = false;
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi) {
+    if (hspi != &hspi1) {
+        return;
+    }
+    cs_high();
+    read_busy = false;
+    missed_reads++;
+}
+
+// newest finished read, false until the first one lands
+bool Gyro_GetLatest(GyroRawData *data) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool ok = have_sample;
+    *data = latest;
+    __set_PRIMASK(primask);
+    return ok;
+}
+
+uint32_t Gyro_GetMissedReads(void) {
+    return missed_reads;
+}
+
+// power down while we sleep, it takes a few hundred ms to settle after coming back
+void Gyro_SetPower(bool on) {
+    uint32_t start = HAL_GetTick();
+    while (read_busy && HAL_GetTick() - start < SPI_TIMEOUT) {}
+    write_reg(CTRL_REG1, on ? CTRL1_190HZ_ENABLED : CTRL1_POWER_DOWN);
+}
@@ -0,0 +1,88 @@
+/* host_port.c
+ * stand ins for the HAL tick, TIM2 timebase and USART2 so main.c runs on a
+ * PC, fed by the CSV replay backend (sensor_replay.c). Empty on the board.
+ *
+ * from STM32/WorkoutInference, something like:
+ *   gcc -O2 -DHOST_BUILD -DSENSOR_BACKEND=SENSOR_BACKEND_REPLAY \
+ *       -ICore/Inc -IMiddlewares/ST/AI/Inc -IX-CUBE-AI/App \
+ *       Core/Src/{main,host_port,sensor_replay,workout_inference,resampler,motion,scheduler,telemetry,stream_net}.c \
+ *       X-CUBE-AI/App/network*.c <x86 build of the network runtime> -lm -o replay
+ *   REPLAY_CSV=../../TrainingDataEAI/JumpRope_02-14-04/WatchAccelerometerUncalibrated.csv \
+ *       REPLAY_SPEED=0 ./replay
+ * The runtime in Middlewares/ST/AI/Lib is Cortex-M4 only, the x86 one comes
+ * with the X-CUBE-AI pack.
+ */
+
+#ifdef HOST_BUILD
+
+#include "host_port.h"
+#include "timebase.h"
+#include "uart.h"
+#include <stdio.h>
+#include <time.h>
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+static uint64_t boot_us;
+
+void HAL_Init(void) {
+    boot_us = now_us();
+}
+
+uint32_t HAL_GetTick(void) {
+    return (uint32_t)((now_us() - boot_us) / 1000);
+}
+
+// what WFI would be, nothing raises an irq here so just nap a little
+void Host_Idle(void) {
+    struct timespec ts = {0, 100000};
+    nanosleep(&ts, NULL);
+}
+
+void Timebase_Init(void) {}
+
+uint32_t Timebase_Micros(void) {
+    return (uint32_t)(now_us() - boot_us);
+}
+
+void UART_Init(void) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+}
+
+int getchar_nonblocking(void) {
+    return -1;  // stdin is a terminal or a pipe, don't let it stall the loop
+}
+
+int getchar_polled(void) {
+    return getchar();
+}
+
+void putchar_polled(int c) {
+    putchar(c);
+}
+
+uint32_t UART_GetBlockedUs(void) {
+    return 0;   // stdout never holds us up in a way worth counting
+}
+
+void sendString(const char *str) {
+    fputs(str, stdout);
+}
+
+void sendStringGreen(const char *str) {
+    sendString(ANSI_GREEN_BOLD);
+    sendString(str);
+    sendString(ANSI_RESET);
+}
+
+void sendCharGreen(uint8_t ch) {
+    sendString(ANSI_GREEN_BOLD);
+    putchar_polled(ch);
+    sendString(ANSI_RESET);
+}
+
+#endif
@@ -0,0 +1,297 @@
+/* i2c_engine.c
+ * interrupt driven register reads on I2C1, register level
+ *
+ * START -> addr(W) -> reg -> reSTART -> addr(R) -> DMA the data -> STOP,
+ * each arrow is one event irq so nothing ever sits polling a flag. A TIM2
+ * compare alarm is armed for the transaction's budget; if it fires first
+ * the peripheral gets reset and SCL clocked by hand until the slave lets go
+ * of SDA (the classic "slave stuck mid byte" hang).
+ *
+ * The peripheral still has to be set up (clock, pins, timing) by
+ * HAL_I2C_Init beforehand, blocking HAL calls keep working in between our
+ * transactions for the config writes.
+ */
+
+#include "i2c_engine.h"
+#include "stm32f4xx_hal.h"
+#include "timebase.h"
+#include <stddef.h>
+
+#define I2C_ENGINE_IRQ_PRIORITY 2   // same as the accel EXTI that starts our reads
+
+// PB6 = SCL, PB9 = SDA, same as accelerometer.c
+#define SCL_PIN                 6
+#define SDA_PIN                 9
+#define BUS_CLEAR_HALF_US       5   // ~100kHz while bit banging
+#define STOP_WAIT_US            50  // a STOP and BUSY dropping after it take a few us at 400kHz
+
+#define SR1_ERRORS              (I2C_SR1_BERR | I2C_SR1_ARLO | I2C_SR1_AF | I2C_SR1_OVR | I2C_SR1_TIMEOUT)
+
+typedef enum {
+    ST_IDLE,
+    ST_START_W,     // waiting on SB to send the write address
+    ST_ADDR_W,      // waiting on ADDR to send the register
+    ST_REG,         // waiting on BTF to send the repeated start
+    ST_START_R,     // waiting on SB to send the read address
+    ST_ADDR_R,      // waiting on ADDR to hand the data over to DMA
+    ST_DATA         // DMA's got it, waiting on transfer complete
+} EngineState;
+
+// not static, the irq handler in stm32f4xx_it.c needs it
+DMA_HandleTypeDef hdma_i2c1_rx;
+
+static volatile EngineState state = ST_IDLE;
+static uint8_t cur_addr;
+static uint8_t cur_reg;
+static uint8_t *cur_buf;
+static uint16_t cur_len;
+static I2CEngine_Done cur_done;
+static I2CEngineStats stats;
+
+static void wait_us(uint32_t us) {
+    uint32_t start = Timebase_Micros();
+    while (Timebase_Micros() - start < us) {}
+}
+
+static void set_pin_mode(uint32_t pin, uint32_t mode) {
+    GPIOB->MODER = (GPIOB->MODER & ~(3U << (pin * 2))) | (mode << (pin * 2));
+}
+
+// reset the peripheral and clock SCL until the slave lets go of SDA, then
+// put a STOP on the bus. Bounded, ~100us worst case
+static void bus_recover(void) {
+    stats.bus_clears++;
+
+    // SWRST wipes the timing registers, hang on to them
+    uint32_t cr2 = I2C1->CR2 & I2C_CR2_FREQ;
+    uint32_t ccr = I2C1->CCR;
+    uint32_t trise = I2C1->TRISE;
+    uint32_t oar1 = I2C1->OAR1;
+    I2C1->CR1 = 0;
+
+    // pins are already open drain, just take them off the peripheral
+    GPIOB->BSRR = (1U << SCL_PIN) | (1U << SDA_PIN);
+    set_pin_mode(SCL_PIN, 1);
+    set_pin_mode(SDA_PIN, 1);
+
+    for (uint8_t i = 0; i < 9 && !(GPIOB->IDR & (1U << SDA_PIN)); i++) {
+        GPIOB->BSRR = (1U << SCL_PIN) << 16;
+        wait_us(BUS_CLEAR_HALF_US);
+        GPIOB->BSRR = (1U << SCL_PIN);
+        wait_us(BUS_CLEAR_HALF_US);
+    }
+
+    // STOP: SDA low -> high while SCL is high
+    GPIOB->BSRR = (1U << SDA_PIN) << 16;
+    wait_us(BUS_CLEAR_HALF_US);
+    GPIOB->BSRR = (1U << SDA_PIN);
+    wait_us(BUS_CLEAR_HALF_US);
+
+    set_pin_mode(SCL_PIN, 2);
+    set_pin_mode(SDA_PIN, 2);
+
+    I2C1->CR1 = I2C_CR1_SWRST;
+    I2C1->CR1 = 0;
+    I2C1->CR2 = cr2;
+    I2C1->CCR = ccr;
+    I2C1->TRISE = trise;
+    I2C1->OAR1 = oar1;
+    I2C1->CR1 = I2C_CR1_PE;
+}
+
+// the last transaction's STOP can still be going out when the next read
+// starts (one chained off the done callback), let it finish before BUSY
+// counts as a stuck slave. Bounded, false if the bus never let go
+static bool wait_bus_free(void) {
+    uint32_t start = Timebase_Micros();
+    while ((I2C1->CR1 & I2C_CR1_STOP) || (I2C1->SR2 & I2C_SR2_BUSY)) {
+        if (Timebase_Micros() - start >= STOP_WAIT_US) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void finish(bool ok) {
+    Timebase_CancelAlarm();
+    I2C1->CR2 &= ~(I2C_CR2_ITEVTEN | I2C_CR2_ITERREN | I2C_CR2_DMAEN | I2C_CR2_LAST);
+    if (ok) {
+        stats.completed++;
+    }
+
+    I2CEngine_Done done = cur_done;
+    cur_done = NULL;
+    state = ST_IDLE;
+    if (done) {
+        done(ok);
+    }
+}
+
+static void abort_dma(void) {
+    if (state == ST_DATA) {
+        HAL_DMA_Abort(&hdma_i2c1_rx);
+    }
+}
+
+// TIM2 alarm, the transaction blew its budget
+static void on_timeout(void) {
+    if (state == ST_IDLE) {
+        return;
+    }
+    stats.timeouts++;
+    abort_dma();
+    bus_recover();
+    finish(false);
+}
+
+static void on_dma_done(DMA_HandleTypeDef *hdma) {
+    (void)hdma;
+    // LAST already NAKed the final byte, just close it out
+    I2C1->CR1 |= I2C_CR1_STOP;
+    finish(true);
+}
+
+static void on_dma_error(DMA_HandleTypeDef *hdma) {
+    (void)hdma;
+    stats.errors++;
+    I2C1->CR1 |= I2C_CR1_STOP;
+    finish(false);
+}
+
+void I2CEngine_Init(void) {
+    // I2C1_RX lives on DMA1 stream 0 channel 1
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    hdma_i2c1_rx.Instance = DMA1_Stream0;
+    hdma_i2c1_rx.Init.Channel = DMA_CHANNEL_1;
+    hdma_i2c1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_i2c1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_i2c1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_i2c1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_i2c1_rx.Init.Mode = DMA_NORMAL;
+    hdma_i2c1_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_i2c1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    HAL_DMA_Init(&hdma_i2c1_rx);
+    hdma_i2c1_rx.XferCpltCallback = on_dma_done;
+    hdma_i2c1_rx.XferErrorCallback = on_dma_error;
+
+    HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, I2C_ENGINE_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+    HAL_NVIC_SetPriority(I2C1_EV_IRQn, I2C_ENGINE_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(I2C1_EV_IRQn);
+    HAL_NVIC_SetPriority(I2C1_ER_IRQn, I2C_ENGINE_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(I2C1_ER_IRQn);
+}
+
+// starts reading len (>= 2) bytes from reg, returns right away. false if a
+// transaction is already running or the bus is stuck even after a clear.
+// addr is the 8 bit (already shifted) address
+bool I2CEngine_Read(uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t len, I2CEngine_Done done) {
+    if (state != ST_IDLE || len < 2) {
+        return false;
+    }
+
+    if (!wait_bus_free()) {
+        if (I2C1->CR1 & I2C_CR1_STOP) {
+            return false;  // slave's stretching our STOP out, not stuck yet
+        }
+        // a slave holding SDA from some earlier mess shows up as BUSY with nobody on the bus
+        bus_recover();
+        if (I2C1->SR2 & I2C_SR2_BUSY) {
+            return false;
+        }
+    }
+
+    cur_addr = addr;
+    cur_reg = reg;
+    cur_buf = buf;
+    cur_len = len;
+    cur_done = done;
+    state = ST_START_W;
+
+    Timebase_SetAlarm(Timebase_Micros() + I2C_ENGINE_BUDGET_BASE_US + len * I2C_ENGINE_BUDGET_BYTE_US,
+                      on_timeout);
+    I2C1->SR1 &= ~SR1_ERRORS;
+    I2C1->CR2 |= I2C_CR2_ITEVTEN | I2C_CR2_ITERREN;
+    I2C1->CR1 |= I2C_CR1_ACK | I2C_CR1_START;
+    return true;
+}
+
+bool I2CEngine_Busy(void) {
+    return state != ST_IDLE;
+}
+
+void I2CEngine_GetStats(I2CEngineStats *out) {
+    *out = stats;
+}
+
+void I2CEngine_EventIRQ(void) {
+    uint32_t sr1 = I2C1->SR1;
+
+    switch (state) {
+    case ST_START_W:
+        if (sr1 & I2C_SR1_SB) {
+            I2C1->DR = cur_addr;
+            state = ST_ADDR_W;
+        }
+        break;
+
+    case ST_ADDR_W:
+        if (sr1 & I2C_SR1_ADDR) {
+            (void)I2C1->SR2;
+            I2C1->DR = cur_reg;
+            state = ST_REG;
+        }
+        break;
+
+    case ST_REG:
+        if (sr1 & I2C_SR1_BTF) {
+            I2C1->CR1 |= I2C_CR1_START;
+            state = ST_START_R;
+        }
+        break;
+
+    case ST_START_R:
+        if (sr1 & I2C_SR1_SB) {
+            I2C1->DR = cur_addr | 0x01;
+            state = ST_ADDR_R;
+        }
+        break;
+
+    case ST_ADDR_R:
+        if (sr1 & I2C_SR1_ADDR) {
+            // DMA has to be armed before ADDR clears, LAST makes the
+            // peripheral NAK the final byte by itself
+            HAL_DMA_Start_IT(&hdma_i2c1_rx, (uint32_t)&I2C1->DR, (uint32_t)cur_buf, cur_len);
+            I2C1->CR2 |= I2C_CR2_DMAEN | I2C_CR2_LAST;
+            I2C1->CR2 &= ~I2C_CR2_ITEVTEN;  // BTF would just keep firing while DMA drains
+            state = ST_DATA;
+            (void)I2C1->SR2;
+        }
+        break;
+
+    default:
+        // nothing of ours, clear whatever's latched so it doesn't keep firing
+        (void)I2C1->SR2;
+        break;
+    }
+}
+
+void I2CEngine_ErrorIRQ(void) {
+    uint32_t sr1 = I2C1->SR1;
+    I2C1->SR1 &= ~SR1_ERRORS;
+
+    if (state == ST_IDLE) {
+        return;
+    }
+    stats.errors++;
+    abort_dma();
+
+    if (sr1 & (I2C_SR1_BERR | I2C_SR1_ARLO)) {
+        // lost track of where the bus is, start from scratch
+        bus_recover();
+    } else {
+        I2C1->CR1 |= I2C_CR1_STOP;  // NAK, just let go
+    }
+    finish(false);
+}
@@ -4,16 +4,92 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#ifdef HOST_BUILD
+#include "host_port.h"
+#else
 #include "stm32f411xe.h"
 #include "main.h"
+#endif
 #include "uart.h"
 #include "workout_inference.h"
 #include "accelerometer.h"
+#include "sensor.h"
+#include "gyro.h"
+#include "timebase.h"
+#include "motion.h"
+#include "i2c_engine.h"
+#include "scheduler.h"
+#include "telemetry.h"
+#include "energy.h"
+#ifndef HOST_BUILD
+#include "power.h"
+#include "clock.h"
+#include "ramfunc.h"
+#include "memwatch.h"
+#endif
+
+#if WORKOUT_USE_GYRO && SENSOR_BACKEND != SENSOR_BACKEND_LSM303
+#error "the recordings are accel only, there's no gyro to replay"
+#endif
+
+// the wake up half of this is the LSM303's own motion interrupt
+#define SLEEP_WHEN_STILL    (MOTION_SLEEP_ENABLE && SENSOR_BACKEND == SENSOR_BACKEND_LSM303)
+
+// how many sample periods a read can slip before something's lost: the next
+// conversion lands on top of the last one, or the FIFO fills up
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+#define ACQUIRE_SLACK_SAMPLES   (ACCEL_FIFO_DEPTH - ACCEL_FIFO_WATERMARK)
+#else
+#define ACQUIRE_SLACK_SAMPLES   1
+#endif
+
+#define REPORT_PERIOD_MS        100     // how often the terminal gets checked for 's'
+
+// what 'h' on the terminal steps the hop through, WORKOUT_HOP_MS is the start
+static const uint16_t hop_steps_ms[] = {10, 20, 50, 100, 250, 500, 1000, 2000};
+
+// and 'r' the sensor's ODR, the resampler takes whatever it is back to 100Hz
+static const uint16_t odr_steps_hz[] = {25, 50, 100, 200};
+
+// 'r' asks, acquire switches between reads (nothing else is on the sensor's
+// bus then) and leaves the answer for report to print
+static volatile uint16_t odr_request = 0;
+static volatile uint16_t odr_done = 0;
+static volatile bool odr_ok;
+
+static const SensorBackend *sensor = SENSOR_DEFAULT;
+
+#if ENERGY_ACCOUNTING && !defined(HOST_BUILD)
+static const char *const energy_names[ENERGY_STAGES] = {
+    "sensor io", "quantize", "network", "uart", "other", "sleep", "stop", "sensors"
+};
+#endif
+
+// network run time, best case is the one nothing preempted
+static uint32_t infer_cycles_best = UINT32_MAX;
+static uint32_t infer_cycles_last = 0;
+
+static void acquire_run(void);
+static void infer_run(void);
+static void report_run(void);
+static void telemetry_run(void);
+
+// acquire runs at the TIM3 level and never waits on the other two, which are
+// deferred to PendSV and get preempted by it. Its ready and deadline depend on
+// the sensor, main fills them in
+static SchedTask acquire_task = {.name = "acquire", .run = acquire_run};
+static SchedTask infer_task = {.name = "infer", .run = infer_run, .deadline_us = WORKOUT_HOP_MS * 1000,
+                               .deferred = true};
+static SchedTask report_task = {.name = "report", .run = report_run, .deferred = true,
+                                .period_ms = REPORT_PERIOD_MS, .deadline_us = REPORT_PERIOD_MS * 1000};
+static SchedTask telemetry_task = {.name = "tlm", .run = telemetry_run, .deferred = true,
+                                   .period_ms = TELEMETRY_PERIOD_MS, .deadline_us = REPORT_PERIOD_MS * 1000};
 
 void delay(volatile uint32_t t) {
     while(t--);
 }
 
+#ifndef HOST_BUILD
 void SystemClock_Config(void) {
     RCC_OscInitTypeDef RCC_OscInitStruct = {0};
     RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
@@ -45,13 +121,411 @@ void Error_Handler(void) {
     __disable_irq();
     while(1) {}
 }
+#endif
+
+#if WORKOUT_USE_GYRO && ACCEL_ACQ_MODE != ACCEL_ACQ_POLLED
+// gyro read goes out the moment the accel converts, so the pair lines up
+void Accel_ConversionCallback(void) {
+    Gyro_StartRead();
+}
+#endif
+
+// 's' on the terminal dumps how well the sample stream is keeping time
+static void print_sample_stats(void) {
+    SampleStats stats;
+    Workout_GetSampleStats(&stats);
+    stats.driver_missed = sensor->get_missed();
+
+    char buf[200];
+    sprintf(buf, "\r\n>>>> SAMPLES: %lu fresh, %lu repeats, %lu overruns, %lu lost, %lu gaps, %lu driver missed\r\n",
+            (unsigned long)stats.samples, (unsigned long)stats.repeats, (unsigned long)stats.overruns,
+            (unsigned long)stats.lost, (unsigned long)stats.gap_missed, (unsigned long)stats.driver_missed);
+    sendStringGreen(buf);
+#if WORKOUT_USE_GYRO
+    // a gyro read that didn't finish in time doesn't lose the sample, it goes
+    // out with the gyro reading before
+    sprintf(buf, "    Gyro: %lu reads missed\r\n", (unsigned long)Gyro_GetMissedReads());
+    sendString(buf);
+#endif
+#if ACCEL_USE_DMA && SENSOR_BACKEND == SENSOR_BACKEND_LSM303
+    I2CEngineStats i2c;
+    I2CEngine_GetStats(&i2c);
+    sprintf(buf, "    I2C: %lu ok, %lu errors, %lu timeouts, %lu bus clears\r\n",
+            (unsigned long)i2c.completed, (unsigned long)i2c.errors, (unsigned long)i2c.timeouts,
+            (unsigned long)i2c.bus_clears);
+    sendString(buf);
+#endif
+    if (stats.samples > 1) {
+        sprintf(buf, "    Jitter: %ld..%ld us\r\n", (long)stats.jitter_min_us, (long)stats.jitter_max_us);
+        sendString(buf);
+    }
+    sprintf(buf, "    |jitter| <50us:%lu <100:%lu <250:%lu <500:%lu <1ms:%lu <2.5ms:%lu <5ms:%lu more:%lu\r\n",
+            (unsigned long)stats.jitter_hist[0], (unsigned long)stats.jitter_hist[1],
+            (unsigned long)stats.jitter_hist[2], (unsigned long)stats.jitter_hist[3],
+            (unsigned long)stats.jitter_hist[4], (unsigned long)stats.jitter_hist[5],
+            (unsigned long)stats.jitter_hist[6], (unsigned long)stats.jitter_hist[7]);
+    sendString(buf);
+
+    // what the hop actually got us. One shorter than an inference takes just
+    // has hops go by without one
+    uint32_t elapsed = Scheduler_StatsElapsedUs();
+    uint32_t rate = elapsed ? (uint32_t)((uint64_t)infer_task.stats.runs * 10000000 / elapsed) : 0;
+    sprintf(buf, "    Hop: %u ms, %lu.%lu inferences/s, %lu hops skipped, %lu windows overrun\r\n",
+            Workout_GetHopMs(), (unsigned long)(rate / 10), (unsigned long)(rate % 10),
+            (unsigned long)stats.hops_skipped, (unsigned long)stats.windows_overrun);
+    sendString(buf);
+#if WORKOUT_STREAMING
+    sprintf(buf, "    Stream: %lu checked against the network, %lu came out different\r\n",
+            (unsigned long)stats.stream_checks, (unsigned long)stats.stream_mismatches);
+    sendString(buf);
+#endif
+
+#ifndef HOST_BUILD
+    // how much of the time the core was actually up, and what that comes to per sample
+    PowerStats power;
+    Power_GetStats(&power);
+    uint32_t awake_us = power.elapsed_us - (uint32_t)power.asleep_us;
+    uint32_t awake = power.elapsed_us ? (uint32_t)((uint64_t)awake_us * 1000 / power.elapsed_us) : 0;
+    sprintf(buf, "    Power: awake %lu.%lu%%, %lu us per sample, %lu sleeps, %lu stops, wake %lu us max\r\n",
+            (unsigned long)(awake / 10), (unsigned long)(awake % 10),
+            (unsigned long)(stats.samples ? awake_us / stats.samples : 0),
+            (unsigned long)power.sleeps, (unsigned long)power.stops, (unsigned long)power.max_wake_us);
+    sendString(buf);
+
+    if (infer_cycles_last) {
+        sprintf(buf, "    %s: %lu cycles best, %lu last, %s\r\n", WORKOUT_STREAMING ? "Classify" : "Network",
+                (unsigned long)infer_cycles_best, (unsigned long)infer_cycles_last,
+                WORKOUT_RAMFUNC ? "hot paths in RAM" : "all in flash");
+        sendString(buf);
+    }
+
+    ClockStats clock;
+    Clock_GetStats(&clock);
+    sprintf(buf, "    Clock: %lu boosts, switch %lu us max\r\n",
+            (unsigned long)clock.boosts, (unsigned long)clock.max_switch_us);
+    sendString(buf);
+
+#if ENERGY_ACCOUNTING
+    // datasheet model of where the charge goes. The average current in mA is
+    // also the mAh one hour of workout costs, the uAh is what this stretch took
+    EnergyReport energy;
+    Energy_GetReport(&energy);
+    uint64_t total = 0;
+    for (uint8_t i = 0; i < ENERGY_STAGES; i++) {
+        total += energy.charge_pc[i];
+    }
+    uint32_t used_uah = (uint32_t)(total / 3600000000ULL);  // uA x us -> uAh
+    sprintf(buf, "    Energy: %lu.%02lu mA avg (mAh/hour), %lu uAh used over %lu s\r\n     ",
+            (unsigned long)(energy.avg_ua / 1000), (unsigned long)(energy.avg_ua % 1000 / 10),
+            (unsigned long)used_uah, (unsigned long)(energy.elapsed_us / 1000000));
+    sendString(buf);
+    for (uint8_t i = 0; i < ENERGY_STAGES; i++) {
+        uint32_t share = total ? (uint32_t)(energy.charge_pc[i] * 1000 / total) : 0;
+        sprintf(buf, " %s %lu.%lu%%", energy_names[i], (unsigned long)(share / 10), (unsigned long)(share % 10));
+        sendString(buf);
+    }
+    sendString("\r\n");
+#endif
+
+    // against what the linker script reserves, to know how far those can come down
+    MemStats mem;
+    Memwatch_GetStats(&mem);
+    sprintf(buf, "    Memory: stack %lu/%lu bytes, heap %lu/%lu bytes (%lu refused), %lu bytes never touched\r\n",
+            (unsigned long)mem.stack_used, (unsigned long)mem.stack_reserved, (unsigned long)mem.heap_used,
+            (unsigned long)mem.heap_reserved, (unsigned long)mem.heap_failures, (unsigned long)mem.untouched);
+    sendString(buf);
+#endif
+
+    // where the CPU time went, load is the share of wall time the task ran for
+    SchedTask *tasks[] = {&acquire_task, &infer_task, &report_task, &telemetry_task};
+    for (uint8_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++) {
+        const SchedTaskStats *t = &tasks[i]->stats;
+        uint32_t avg = t->runs ? (uint32_t)(t->total_run_us / t->runs) : 0;
+        uint32_t load = elapsed ? (uint32_t)(t->total_run_us * 1000 / elapsed) : 0;
+        sprintf(buf, "    %-8s %lu runs, avg %lu us, max %lu us, max wait %lu us, %lu.%lu%% load, %lu late, %lu overruns\r\n",
+                tasks[i]->name, (unsigned long)t->runs, (unsigned long)avg, (unsigned long)t->max_run_us,
+                (unsigned long)t->max_latency_us, (unsigned long)(load / 10), (unsigned long)(load % 10),
+                (unsigned long)t->deadline_misses, (unsigned long)t->overruns);
+        sendString(buf);
+    }
+    sendString("\r\n");
+}
+
+#if SLEEP_WHEN_STILL
+// acquire asks for it (TIM3 level, can't block there), thread mode does it
+static volatile bool sleep_requested = false;
+
+// and until it's done the sensor's thread mode's, acquire keeps off it
+static bool acquire_ready(void) {
+    return !sleep_requested && sensor->data_ready();
+}
+
+// nobody's moving: park the sensors, Stop the MCU until the accel's motion
+// interrupt fires, then bring a fresh window back up. Thread mode, between
+// Scheduler_Polls
+static void sleep_until_motion(void) {
+    sendString("no motion, going to sleep\r\n");
+
+    // accel first, so its INT1 stops kicking gyro reads before the gyro goes down
+    Accel_ArmMotionWake(MOTION_WAKE_THRESHOLD_MG);
+#if WORKOUT_USE_GYRO
+    Gyro_SetPower(false);
+#endif
+
+    // the same Stop the idle loop does between samples, so the clocks, ticks
+    // and power stats all keep up. report still gets its turn on any wakeup
+    Power_StopUntil(Accel_MotionWoke);
+    while (!Accel_MotionWoke()) {
+        Scheduler_Poll();
+    }
+    Power_StopUntil(NULL);
+
+#if WORKOUT_USE_GYRO
+    Gyro_SetPower(true);
+#endif
+    Accel_DisarmMotionWake();
+
+    // whatever's in the window is from before we slept, and so is anything
+    // the driver still has from before acquire got shut out
+    AccelRawData stale[SENSOR_MAX_BURST];
+    sensor->read(stale, SENSOR_MAX_BURST);
+    Workout_ResetBuffer();
+    Workout_ResetSampleStats();
+    Scheduler_ResetStats();
+    Power_ResetStats();
+    Energy_ResetStats();
+    Telemetry_Reset();
+    Motion_Reset();
+    sleep_requested = false;
+    sendString("motion, waking up\r\n");
+}
+#endif
+
+// the window's resampler and acquire's deadline both go off the sensor's rate
+static bool follow_odr(uint16_t hz) {
+    acquire_task.deadline_us = 1000000 / hz * ACQUIRE_SLACK_SAMPLES;
+    return Workout_SetInputRate(hz);
+}
+
+// acquire level only. Sensor first, if the resampler can't take the new rate
+// the sensor goes back to the old one
+static bool set_odr(uint16_t hz) {
+    uint16_t old = sensor->get_odr();
+    if (!sensor->set_odr || !sensor->set_odr(hz)) {
+        return false;
+    }
+    if (!follow_odr(hz)) {
+        sensor->set_odr(old);
+        follow_odr(old);
+        return false;
+    }
+    // fresh stats for the new rate, like a hop change
+    Scheduler_ResetStats();
+    Telemetry_Reset();
+#ifndef HOST_BUILD
+    Power_ResetStats();
+    Energy_ResetStats();
+#endif
+    return true;
+}
+
+// new samples off the sensor (a conversion, a FIFO watermark, or in polled
+// mode a period gone by) into the window
+static void acquire_run(void) {
+    AccelRawData accelData[SENSOR_MAX_BURST];
+
+    if (odr_request) {
+        odr_ok = set_odr(odr_request);
+        odr_done = odr_request;
+        odr_request = 0;
+    }
+
+#if WORKOUT_USE_GYRO && ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+    Gyro_StartRead(); // DMA runs while the accel read below is on I2C
+#endif
+    Energy_Begin(ENERGY_SENSOR_IO);
+    uint8_t n = sensor->read(accelData, SENSOR_MAX_BURST);
+    Energy_End();
+    if (n == 0) {
+        return;
+    }
+#if WORKOUT_USE_GYRO
+    GyroRawData gyroData;
+    if (Gyro_GetLatest(&gyroData)) {
+        Workout_SetGyro(&gyroData);
+    }
+#endif
+    Energy_Begin(ENERGY_QUANTIZE);
+    Workout_AddSamples(accelData, n); // whole burst into the buffer
+    Energy_End();
+#if SLEEP_WHEN_STILL
+    bool quiet = false;
+    for (uint8_t i = 0; i < n; i++) {
+        quiet = Motion_Update(&accelData[i]);
+    }
+    if (quiet) {
+        sleep_requested = true;
+        return;
+    }
+#endif
+
+    // inference once every hop of samples. The window gets copied out right
+    // here, so infer sees exactly the samples that released it no matter how
+    // long it takes to get going. If the last one's still running we try
+    // again on the next sample
+    if (Workout_ShouldInfer()) {
+        Energy_Begin(ENERGY_QUANTIZE);
+        bool snapped = Workout_Snapshot();
+        Energy_End();
+        if (snapped) {
+            Scheduler_Release(&infer_task);
+        }
+    }
+}
+
+static void infer_run(void) {
+    WorkoutResult result;
+#ifndef HOST_BUILD
+    // the network's the only thing that needs more than the HSI, streaming
+    // only runs it as the odd check
+    bool boost = Workout_NetworkDue();
+    if (boost) {
+        Clock_Boost();
+    }
+    Energy_Begin(ENERGY_NETWORK);
+    bool ok = Workout_RunInference(&result);
+    Energy_End();
+    if (boost) {
+        Clock_Relax();
+    }
+#else
+    bool ok = Workout_RunInference(&result);
+#endif
+    if (ok) {
+        infer_cycles_last = result.inference_cycles;
+        if (result.inference_cycles < infer_cycles_best) {
+            infer_cycles_best = result.inference_cycles;
+        }
+
+#if WORKOUT_STREAMING
+        // all of it every 50ms would keep the UART going most of the time,
+        // just the changes and then once a second
+        static WorkoutClass last_class = NUM_CLASSES;
+        static uint16_t quiet = 0;
+        if (result.predicted_class == last_class && ++quiet < 1000 / Workout_GetHopMs()) {
+            return;
+        }
+        last_class = result.predicted_class;
+        quiet = 0;
+#endif
+
+        // print out all the results
+        char buf[120];
+        sprintf(buf, "\n>>>> WORKOUT DETECTED: %s\r\n", Workout_GetName(result.predicted_class));
+        sendStringGreen(buf);
+
+        sprintf(buf, "    Confidence: %.1f%% \r\n", result.confidence);
+        sendString(buf);
+
+        // all class scores
+        sendString("    All scores: ");
+        for (int i = 0; i < NUM_CLASSES; i++) {
+            sprintf(buf, "%s:%.0f%% ", Workout_GetName((WorkoutClass)i), result.class_scores[i]);
+            sendString(buf);
+        }
+        sendString("\r\n\n");
+
+    } else {
+        // sendString("Inference failed :(\r\n");
+    }
+}
+
+// next hop in hop_steps_ms, the stats start over so 's' shows just this setting
+static void step_hop(void) {
+    uint8_t n = sizeof(hop_steps_ms) / sizeof(hop_steps_ms[0]);
+    uint8_t i = 0;
+    while (i < n && hop_steps_ms[i] <= Workout_GetHopMs()) {
+        i++;
+    }
+
+    // acquire preempts us and uses all of this, keep it out till we're done
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // streaming skips the ones that aren't whole pool blocks
+    while (!Workout_SetHop(hop_steps_ms[i % n])) {
+        i++;
+    }
+    infer_task.deadline_us = (uint32_t)Workout_GetHopMs() * 1000;  // done before the next one's due
+    Workout_ResetSampleStats();
+    Scheduler_ResetStats();
+    Telemetry_Reset();
+#ifndef HOST_BUILD
+    Power_ResetStats();
+    Energy_ResetStats();
+#endif
+    __set_PRIMASK(primask);
+
+    char buf[40];
+    sprintf(buf, "hop now %u ms\r\n", Workout_GetHopMs());
+    sendString(buf);
+}
+
+// next rate in odr_steps_hz, acquire does the actual switch
+static void step_odr(void) {
+    if (!sensor->set_odr) {
+        sendString("sensor rate is fixed\r\n");
+        return;
+    }
+    uint8_t n = sizeof(odr_steps_hz) / sizeof(odr_steps_hz[0]);
+    uint8_t i = 0;
+    while (i < n && odr_steps_hz[i] <= sensor->get_odr()) {
+        i++;
+    }
+    odr_request = odr_steps_hz[i % n];
+}
+
+static void report_run(void) {
+    if (odr_done) {
+        char buf[40];
+        sprintf(buf, odr_ok ? "odr now %u Hz\r\n" : "can't run at %u Hz\r\n", odr_done);
+        sendString(buf);
+        odr_done = 0;
+    }
+
+    int c = getchar_nonblocking();
+    if (c == 's') {
+        print_sample_stats();
+    } else if (c == 'h') {
+        step_hop();
+    } else if (c == 'r') {
+        step_odr();
+    } else if (c == 't') {
+        Telemetry_Print();
+    }
+}
+
+static void telemetry_run(void) {
+    Telemetry_Print();
+}
 
 int main(void) {
+#ifndef HOST_BUILD
+    Memwatch_PaintStack();
+#endif
 	HAL_Init();
     SystemClock_Config();
 
     UART_Init();
-    Accel_Init();
+    Timebase_Init();
+#ifndef HOST_BUILD
+    RamFunc_Report();
+#endif
+    if (!sensor->init()) {
+        sendString("ERROR: sensor init failed\r\n");
+    }
+#if WORKOUT_USE_GYRO
+    Gyro_Init();
+#endif
 
     // set up AI workout detections
     sendString("Initializing\r\n");
@@ -60,48 +534,50 @@ int main(void) {
     }
     sendStringGreen("initialized successfully\r\n");
 
-    uint32_t accel_timer = 0;
-    uint32_t last_inference = 0;
-    AccelRawData accelData;
-
-    while(1) {
-        uint32_t now = HAL_GetTick();
-
-        // Sample accelerometer every 10ms (100hz, same speed we trained the model with)
-        if (now - accel_timer >= 10) {
-            accel_timer = now;
-            Accel_ReadRaw(&accelData);
-            Workout_AddSample(accelData.x, accelData.y, accelData.z); // add to buffer
-
-            // inference, max 1s at a time
-            if (Workout_ShouldInfer() && (now - last_inference > 1000)) {
-
-                WorkoutResult result;
-                if (Workout_RunInference(&result)) {
-
-                    // print out all the results
-                    char buf[120];
-                    sprintf(buf, "\n>>>> WORKOUT DETECTED: %s\r\n", Workout_GetName(result.predicted_class));
-                    sendStringGreen(buf);
-
-                    sprintf(buf, "    Confidence: %.1f%% \r\n", result.confidence);
-                    sendString(buf);
-
-                    // all class scores
-                    sendString("    All scores: ");
-                    for (int i = 0; i < NUM_CLASSES; i++) {
-                        sprintf(buf, "%s:%.0f%% ", Workout_GetName((WorkoutClass)i), result.class_scores[i]);
-                        sendString(buf);
-                    }
-                    sendString("\r\n\n");
+    // sensor may not be running at the model's 100Hz, resample if not
+    if (!follow_odr(sensor->get_odr())) {
+        sendString("ERROR: can't resample the accel ODR\r\n");
+    }
+    if (Workout_WarmStarted()) {
+        sendString("warm restart, picking up the old window\r\n");
+    }
+    infer_task.deadline_us = (uint32_t)Workout_GetHopMs() * 1000;  // the hop may have come through the reset
 
-                    last_inference = now;
+#if SLEEP_WHEN_STILL
+    acquire_task.ready = acquire_ready;
+#else
+    acquire_task.ready = sensor->data_ready;
+#endif
 
-                } else {
-                    // sendString("Inference failed :(\r\n");
-                }
-            }
+    Scheduler_Init();
+#ifndef HOST_BUILD
+    Power_Init();
+    Clock_Init();   // everything's configured, drop to the acquisition clock
+    Energy_Init();
+#endif
+    Scheduler_Add(&acquire_task);
+    Scheduler_Add(&infer_task);
+    Scheduler_Add(&report_task);
+    Telemetry_Init(&acquire_task, &infer_task, sensor->get_missed);
+    if (TELEMETRY_PERIOD_MS) {
+        Scheduler_Add(&telemetry_task);
+    }
 
+    // the board's sensor never runs out, a replay stops at the end of the file
+    while (!(sensor->finished && sensor->finished())) {
+        Scheduler_Poll();
+#if SLEEP_WHEN_STILL
+        if (sleep_requested) {
+            sleep_until_motion();
         }
+#endif
     }
+
+    // only a replay gets here
+    char buf[64];
+    sprintf(buf, "%s done in %lu ms\r\n", sensor->name, (unsigned long)HAL_GetTick());
+    sendString(buf);
+    print_sample_stats();
+    Telemetry_Print();
+    return 0;
 }
@@ -0,0 +1,43 @@
+/* memwatch.c
+ * everything from the top of the heap to just under the stack pointer gets
+ * painted first thing in main, so anything the stack reaches later (irq
+ * frames included, there's only the one stack) loses its paint. That runs
+ * past _Min_Stack_Size into the heap's space too, which is how an overflow
+ * shows up as stack_used > stack_reserved instead of just "full"
+ */
+
+#include "memwatch.h"
+#include "stm32f4xx.h"
+
+// from the linker script
+extern uint8_t _end;
+extern uint8_t _estack;
+extern uint32_t _Min_Stack_Size;
+extern uint32_t _Min_Heap_Size;
+
+// call before anything else in main, nothing below here's live yet
+void Memwatch_PaintStack(void) {
+    uint32_t *p = (uint32_t *)(((uint32_t)&_end + Sysmem_HeapUsed() + 3) & ~3u);
+    uint32_t *sp = (uint32_t *)__get_MSP();
+    while (p < sp - 1) {    // the word at sp might be ours
+        *p++ = MEMWATCH_PAINT;
+    }
+}
+
+// walks up from the heap's top to the first word that lost its paint, a few
+// thousand reads at most
+void Memwatch_GetStats(MemStats *out) {
+    uint32_t heap_top = ((uint32_t)&_end + Sysmem_HeapUsed() + 3) & ~3u;
+    const uint32_t *p = (const uint32_t *)heap_top;
+    const uint32_t *sp = (const uint32_t *)__get_MSP();
+    while (p < sp && *p == MEMWATCH_PAINT) {
+        p++;
+    }
+
+    out->stack_used = (uint32_t)&_estack - (uint32_t)p;
+    out->stack_reserved = (uint32_t)&_Min_Stack_Size;
+    out->heap_used = Sysmem_HeapUsed();
+    out->heap_reserved = (uint32_t)&_Min_Heap_Size;
+    out->heap_failures = Sysmem_HeapFailures();
+    out->untouched = (uint32_t)p - heap_top;
+}
@@ -0,0 +1,50 @@
+/* motion.c
+ * software still-detector on the sample stream
+ *
+ * each axis keeps a slow running average (gravity + posture), any sample
+ * that lands more than MOTION_ACTIVE_MG off it counts as motion. Once
+ * MOTION_QUIET_MS goes by without any, Motion_Update says it's time to sleep
+ */
+
+#include "motion.h"
+
+#define ACTIVE_COUNTS   (MOTION_ACTIVE_MG * ACCEL_COUNTS_PER_G / 1000)
+#define AVG_SHIFT       4   // average moves 1/16 of the way each sample
+#define AVG_FRAC        4   // average kept with 4 extra fraction bits
+
+static int32_t avg[3];
+static uint32_t last_motion_us;
+static bool primed = false;
+
+void Motion_Reset(void) {
+    primed = false;
+}
+
+static bool axis_moved(uint8_t axis, int16_t v) {
+    int32_t scaled = (int32_t)v << AVG_FRAC;
+    int32_t dev = (scaled - avg[axis]) >> AVG_FRAC;
+    avg[axis] += (scaled - avg[axis]) >> AVG_SHIFT;
+    return dev > ACTIVE_COUNTS || dev < -ACTIVE_COUNTS;
+}
+
+// feed every sample, true once it's been quiet for MOTION_QUIET_MS
+bool Motion_Update(const AccelRawData *sample) {
+    if (!primed) {
+        avg[0] = (int32_t)sample->x << AVG_FRAC;
+        avg[1] = (int32_t)sample->y << AVG_FRAC;
+        avg[2] = (int32_t)sample->z << AVG_FRAC;
+        last_motion_us = sample->t_us;
+        primed = true;
+        return false;
+    }
+
+    // no short circuit, all three averages need updating
+    bool moved = axis_moved(0, sample->x);
+    moved |= axis_moved(1, sample->y);
+    moved |= axis_moved(2, sample->z);
+    if (moved) {
+        last_motion_us = sample->t_us;
+        return false;
+    }
+    return sample->t_us - last_motion_us >= (uint32_t)MOTION_QUIET_MS * 1000;
+}
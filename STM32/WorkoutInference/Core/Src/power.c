@@ -0,0 +1,248 @@
+/* power.c
+ * idle handling for the scheduler, register level like timebase.c
+ *
+ * Sleep is just WFI. Stop turns off every clock, TIM2 included, so the time
+ * spent in it is measured on the RTC instead, running off the LSI (the only
+ * clock left going). The LSI is anywhere from 17 to 47kHz, so it gets measured
+ * against TIM2 once at startup. That's good to one LSI tick, ~31us, which is
+ * what the timestamps of samples right after a Stop can be off by.
+ *
+ * Stop only happens when nothing's mid transfer (I2C, gyro SPI, UART), anything
+ * frozen halfway would hang the bus or lose the byte.
+ */
+
+#include "power.h"
+#include "main.h"
+#include "timebase.h"
+#include "uart.h"
+#include "i2c_engine.h"
+#include "gyro.h"
+#include "clock.h"
+#include "workout_inference.h"
+#include <string.h>
+
+#define RTC_PREDIV_S        32767   // subsecond counter runs straight off the LSI
+#define LSI_CAL_PERIODS     128     // LSI periods to time at startup, ~4ms
+#define LSI_NOMINAL_HZ      32000
+#define RTC_TICKS_PER_HOUR  (3600 * (RTC_PREDIV_S + 1))
+#define RX_WAKE_IRQ_PRIORITY 15     // all it does is note the time
+
+static uint32_t lsi_hz = LSI_NOMINAL_HZ;
+static PowerStats stats;
+static uint32_t stats_since_us;
+static uint32_t tick_rem_us = 0;    // Stop time that hasn't made a whole HAL tick yet
+static volatile bool rx_seen = false;
+static volatile uint32_t rx_seen_ms;  // HAL tick of the last RX edge
+static bool (*stop_until)(void) = NULL; // Power_StopUntil's wakeup, NULL when idling as usual
+
+// TIM5 channel 4 can be wired to the LSI internally, time LSI_CAL_PERIODS of
+// it against the 48MHz timer clock
+static void calibrate_lsi(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+    uint32_t clk = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        clk *= 2;
+    }
+
+    TIM5->CR1 = 0;
+    TIM5->PSC = 0;
+    TIM5->ARR = 0xFFFFFFFF;
+    TIM5->OR = TIM_OR_TI4_RMP_0;                                // TI4 = LSI
+    TIM5->CCMR2 = TIM_CCMR2_CC4S_0 | TIM_CCMR2_IC4PSC;          // capture every 8th edge
+    TIM5->CCER = TIM_CCER_CC4E;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->CR1 = TIM_CR1_CEN;
+
+    uint32_t first = 0;
+    uint32_t last = 0;
+    bool timed = true;
+    for (uint32_t i = 0; timed && i <= LSI_CAL_PERIODS / 8; i++) {
+        uint32_t start = HAL_GetTick();
+        while (!(TIM5->SR & TIM_SR_CC4IF)) {
+            if (HAL_GetTick() - start > 10) {
+                timed = false;  // LSI's not running, keep the nominal value
+                break;
+            }
+        }
+        last = TIM5->CCR4;  // reading it clears the flag
+        if (i == 0) {
+            first = last;
+        }
+    }
+
+    // TIM5 back off either way, nothing else uses it
+    TIM5->CR1 = 0;
+    TIM5->CCER = 0;
+    TIM5->OR = 0;
+    RCC->APB1ENR &= ~RCC_APB1ENR_TIM5EN;
+    if (timed && last != first) {
+        lsi_hz = (uint32_t)((uint64_t)clk * LSI_CAL_PERIODS / (last - first));
+    }
+}
+
+// RTC on the LSI with the subsecond counter at full LSI rate, read straight
+// from the counters (no shadow registers to wait on after a Stop)
+static void init_rtc(void) {
+    __HAL_RCC_PWR_CLK_ENABLE();
+    PWR->CR |= PWR_CR_DBP;
+
+    RCC->CSR |= RCC_CSR_LSION;
+    while (!(RCC->CSR & RCC_CSR_LSIRDY)) {}
+
+    if ((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_1) {
+        // clock source can only be changed by resetting the backup domain
+        RCC->BDCR |= RCC_BDCR_BDRST;
+        RCC->BDCR &= ~RCC_BDCR_BDRST;
+        RCC->BDCR |= RCC_BDCR_RTCSEL_1;
+    }
+    RCC->BDCR |= RCC_BDCR_RTCEN;
+
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    RTC->ISR |= RTC_ISR_INIT;
+    while (!(RTC->ISR & RTC_ISR_INITF)) {}
+    RTC->PRER = RTC_PREDIV_S;   // sync first, then async (0), two writes
+    RTC->PRER = RTC_PREDIV_S;
+    RTC->TR = 0;
+    RTC->ISR &= ~RTC_ISR_INIT;
+    RTC->CR |= RTC_CR_BYPSHAD;
+    RTC->WPR = 0xFF;
+}
+
+// PA3 stays on USART2 (AF7), the EXTI edge detector sees the pin either way
+static void init_rx_wake(void) {
+    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+    SYSCFG->EXTICR[0] &= ~SYSCFG_EXTICR1_EXTI3;     // port A
+    EXTI->RTSR &= ~EXTI_RTSR_TR3;
+    EXTI->FTSR |= EXTI_FTSR_TR3;                    // start bits
+    EXTI->PR = EXTI_PR_PR3;
+    EXTI->IMR |= EXTI_IMR_MR3;
+
+    HAL_NVIC_SetPriority(EXTI3_IRQn, RX_WAKE_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+}
+
+// LSI ticks since the top of the RTC's hour, plenty for timing one nap
+static uint32_t rtc_ticks(void) {
+    uint32_t ssr, tr;
+    do {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+    } while (ssr != RTC->SSR || tr != RTC->TR);
+
+    uint32_t sec = ((tr >> 12) & 0x7) * 600 + ((tr >> 8) & 0xF) * 60
+                 + ((tr >> 4) & 0x7) * 10 + (tr & 0xF);
+    return sec * (RTC_PREDIV_S + 1) + (RTC_PREDIV_S - ssr);
+}
+
+// LSI ticks from a to b, across the top of the hour if need be
+static uint32_t rtc_elapsed(uint32_t a, uint32_t b) {
+    return (b + RTC_TICKS_PER_HOUR - a) % RTC_TICKS_PER_HOUR;
+}
+
+static uint32_t ticks_to_us(uint32_t ticks) {
+    return (uint32_t)((uint64_t)ticks * 1000000 / lsi_hz);
+}
+
+static bool can_stop(void) {
+#if ACCEL_USE_DMA
+    if (I2CEngine_Busy()) {
+        return false;
+    }
+#endif
+#if WORKOUT_USE_GYRO
+    if (Gyro_Busy()) {
+        return false;
+    }
+#endif
+    // someone's typing, stay where the UART can still hear them
+    if (rx_seen && HAL_GetTick() - rx_seen_ms < POWER_RX_AWAKE_MS) {
+        return false;
+    }
+    if (!(USART2->SR & USART_SR_TC)) {
+        return false;
+    }
+    if (stop_until && !stop_until()) {
+        return true;
+    }
+    return POWER_IDLE_MODE == POWER_IDLE_STOP;
+}
+
+// Stop until an EXTI line fires, then put the clocks back and move the
+// microsecond and HAL clocks on by however long they were frozen for
+static uint32_t stop(void) {
+    uint32_t cnt = Timebase_Micros();
+    uint32_t t0 = rtc_ticks();
+
+    HAL_PWR_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON, PWR_STOPENTRY_WFI);
+
+    uint32_t t1 = rtc_ticks();
+    Clock_Restore();        // Stop drops us back on the 16MHz HSI
+    uint32_t t2 = rtc_ticks();
+
+    uint32_t frozen_us = ticks_to_us(rtc_elapsed(t0, t2));
+    TIM2->CNT = cnt + frozen_us;
+
+    tick_rem_us += frozen_us;
+    uwTick += tick_rem_us / 1000;
+    tick_rem_us %= 1000;
+
+    uint32_t wake_us = ticks_to_us(rtc_elapsed(t1, t2));
+    stats.stops++;
+    stats.asleep_us += frozen_us - wake_us;
+    stats.stopped_us += frozen_us - wake_us;
+    if (wake_us > stats.max_wake_us) {
+        stats.max_wake_us = wake_us;
+    }
+    return frozen_us;
+}
+
+// the RTC's set up even when idling only Sleeps, Power_StopUntil needs it
+void Power_Init(void) {
+    init_rtc();
+    calibrate_lsi();
+    init_rx_wake();
+    Power_ResetStats();
+}
+
+// called with irqs masked, sleeps until one's pending. Returns how long the
+// clocks were stopped for (0 if they weren't), the scheduler's tick has to
+// catch up on that
+uint32_t Power_Idle(void) {
+    if (can_stop()) {
+        return stop();
+    }
+
+    uint32_t start = Timebase_Micros();
+    __WFI();
+    stats.sleeps++;
+    stats.asleep_us += Timebase_Micros() - start;
+    return 0;
+}
+
+// until woke() says otherwise every idle is a Stop, even with POWER_IDLE_SLEEP.
+// The caller keeps calling Scheduler_Poll, so the irqs that wake us get to run
+// and the ticks catch up the same as between samples. NULL goes back to normal
+void Power_StopUntil(bool (*woke)(void)) {
+    stop_until = woke;
+}
+
+// EXTI3, a falling edge on USART2 RX. Also what gets us out of Stop for it
+void Power_RxWakeIRQ(void) {
+    EXTI->PR = EXTI_PR_PR3;
+    rx_seen_ms = HAL_GetTick();
+    rx_seen = true;
+}
+
+void Power_GetStats(PowerStats *out) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = stats;
+    out->elapsed_us = Timebase_Micros() - stats_since_us;
+    __set_PRIMASK(primask);
+}
+
+void Power_ResetStats(void) {
+    memset(&stats, 0, sizeof(stats));
+    stats_since_us = Timebase_Micros();
+}
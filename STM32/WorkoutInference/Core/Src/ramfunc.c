@@ -0,0 +1,58 @@
+/* ramfunc.c
+ * boot time listing of what runs from RAM. Goes through the symbols that
+ * are meant to be relocated and says where each one actually landed, so a
+ * linker script pattern that stopped matching shows up as "flash"
+ */
+
+#include <stdio.h>
+#include "ramfunc.h"
+#include "uart.h"
+#include "workout_inference.h"
+#include "resampler.h"
+#include "ai_platform_interface.h"
+#include "layers_conv2d.h"
+#include "layers_pool.h"
+#include "network_data.h"
+
+#if RAMFUNC_REPORT
+// from the linker script
+extern uint32_t _sramfunc, _eramfunc, _siramfunc;
+
+typedef struct {
+    const char *name;
+    const void *addr;
+} RelocatedSymbol;
+
+static const RelocatedSymbol symbols[] = {
+    {"Workout_AddSample",               (const void *)Workout_AddSample},
+    {"Workout_Snapshot",                (const void *)Workout_Snapshot},
+    {"Resampler_Push",                  (const void *)Resampler_Push},
+    {"ai_platform_network_process",     (const void *)ai_platform_network_process},
+    {"forward_pw_sssa8_ch",             (const void *)forward_pw_sssa8_ch},
+    {"forward_dw_sssa8_ch",             (const void *)forward_dw_sssa8_ch},
+    {"forward_dense_integer_SSSA_ch",   (const void *)forward_dense_integer_SSSA_ch},
+    {"forward_ap_integer_INT8",         (const void *)forward_ap_integer_INT8},
+    {"forward_mp_integer_INT8",         (const void *)forward_mp_integer_INT8},
+    {"s_network_weights_array_u64",     (const void *)s_network_weights_array_u64},
+};
+#endif
+
+void RamFunc_Report(void) {
+#if RAMFUNC_REPORT
+    uint32_t start = (uint32_t)&_sramfunc;
+    uint32_t end = (uint32_t)&_eramfunc;
+
+    char buf[80];
+    sprintf(buf, "ramfunc: %lu bytes at 0x%08lx, loaded from 0x%08lx\r\n",
+            end - start, start, (uint32_t)&_siramfunc);
+    sendString(buf);
+
+    for (uint8_t i = 0; i < sizeof(symbols) / sizeof(symbols[0]); i++) {
+        uint32_t addr = (uint32_t)symbols[i].addr & ~1u;   // thumb bit off
+        sprintf(buf, "    %-30s 0x%08lx %s\r\n", symbols[i].name, addr,
+                (addr >= start && addr < end) ? "RAM" : "flash");
+        sendString(buf);
+    }
+    // the rest of the kernels' helpers are in the .ramfunc part of the .map
+#endif
+}
@@ -0,0 +1,149 @@
+/* resampler.c
+ * fixed point polyphase L/M resampler for the accel stream
+ *
+ * conceptually: zero stuff by L, lowpass, keep every Mth sample. The polyphase
+ * form only ever evaluates the taps that land on real samples, so each output
+ * is phase_taps multiply-adds per axis. Coefficients get designed (in float)
+ * once in Resampler_Init, everything per sample is int16/int32.
+ */
+
+#include "resampler.h"
+#include "ramfunc.h"
+#include <string.h>
+#include <math.h>
+
+#define PI_F    3.14159265f
+#define Q15_ONE 32768
+
+static uint16_t gcd(uint16_t a, uint16_t b) {
+    while (b) {
+        uint16_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static int16_t clamp_raw(int32_t v) {
+    if (v < ACCEL_RAW_MIN) return ACCEL_RAW_MIN;
+    if (v > ACCEL_RAW_MIN + ACCEL_RAW_COUNT - 1) return ACCEL_RAW_MIN + ACCEL_RAW_COUNT - 1;
+    return (int16_t)v;
+}
+
+bool Resampler_Init(Resampler *rs, uint16_t in_hz, uint16_t out_hz) {
+    memset(rs, 0, sizeof(Resampler));
+    if (in_hz == 0 || out_hz == 0) {
+        return false;
+    }
+
+    uint16_t g = gcd(in_hz, out_hz);
+    uint16_t L = out_hz / g;
+    uint16_t M = in_hz / g;
+    if (L == 1 && M == 1) {
+        rs->bypass = true;
+        return true;
+    }
+
+    // longer filter for whichever side is tighter, rounded up to a whole number of phases
+    uint16_t ratio = (L > M) ? L : M;
+    uint16_t n = RESAMPLER_TAPS_PER_RATE * ratio;
+    n = ((n + L - 1) / L) * L;
+    if (n > RESAMPLER_MAX_TAPS || n / L > RESAMPLER_MAX_PHASE_TAPS) {
+        return false;  // ratio too wild for the static buffers
+    }
+    rs->L = (uint8_t)L;
+    rs->M = (uint8_t)M;
+    rs->phase_taps = (uint8_t)(n / L);
+
+    // hamming windowed sinc at the upsampled rate, cutoff a little under
+    // whichever nyquist (input or output) is lower
+    float proto[RESAMPLER_MAX_TAPS];
+    float fc = 0.45f / ratio;
+    float mid = (n - 1) * 0.5f;
+    for (uint16_t i = 0; i < n; i++) {
+        float t = i - mid;
+        float s = (t == 0.0f) ? 2.0f * fc : sinf(2.0f * PI_F * fc * t) / (PI_F * t);
+        float w = 0.54f - 0.46f * cosf(2.0f * PI_F * i / (n - 1));
+        proto[i] = s * w;
+    }
+
+    // each phase gets its own unity DC gain so a still sensor (just gravity)
+    // comes out at exactly the same counts. Whatever rounding leaves over goes
+    // on the biggest tap
+    for (uint8_t p = 0; p < L; p++) {
+        int16_t *c = &rs->coef[p * rs->phase_taps];
+        float sum = 0.0f;
+        for (uint8_t k = 0; k < rs->phase_taps; k++) {
+            sum += proto[p + k * L];
+        }
+
+        int32_t total = 0;
+        uint8_t biggest = 0;
+        for (uint8_t k = 0; k < rs->phase_taps; k++) {
+            float q = proto[p + k * L] / sum * Q15_ONE;
+            int32_t v = (int32_t)(q < 0.0f ? q - 0.5f : q + 0.5f);
+            if (v > 32767) v = 32767;
+            if (v < -32768) v = -32768;
+            c[k] = (int16_t)v;
+            total += v;
+            if (c[k] > c[biggest]) {
+                biggest = k;
+            }
+        }
+        int32_t fixed = c[biggest] + (Q15_ONE - total);
+        if (fixed <= 32767) {
+            c[biggest] = (int16_t)fixed;
+        }
+    }
+    return true;
+}
+
+// drop the history, e.g. after the ODR changed under us
+void Resampler_Reset(Resampler *rs) {
+    memset(rs->hist, 0, sizeof(rs->hist));
+    rs->phase = 0;
+    rs->head = 0;
+}
+
+// one input sample in, 0..RESAMPLER_MAX_OUT output samples out, returns how many
+RAMFUNC uint8_t Resampler_Push(Resampler *rs, const AccelRawData *in, AccelRawData *out) {
+    if (rs->bypass) {
+        out[0] = *in;
+        return 1;
+    }
+
+    uint8_t taps = rs->phase_taps;
+    rs->hist[0][rs->head] = rs->hist[0][rs->head + taps] = in->x;
+    rs->hist[1][rs->head] = rs->hist[1][rs->head + taps] = in->y;
+    rs->hist[2][rs->head] = rs->hist[2][rs->head + taps] = in->z;
+
+    // newest sample is at head + taps, walking down from there goes back in time
+    const int16_t *hx = &rs->hist[0][rs->head + taps];
+    const int16_t *hy = &rs->hist[1][rs->head + taps];
+    const int16_t *hz = &rs->hist[2][rs->head + taps];
+
+    uint8_t n_out = 0;
+    while (rs->phase < rs->L) {
+        const int16_t *c = &rs->coef[rs->phase * taps];
+        int32_t ax = 1 << 14, ay = 1 << 14, az = 1 << 14;  // start at half an lsb to round
+        for (uint8_t k = 0; k < taps; k++) {
+            ax += c[k] * hx[-k];
+            ay += c[k] * hy[-k];
+            az += c[k] * hz[-k];
+        }
+        out[n_out].x = clamp_raw(ax >> 15);
+        out[n_out].y = clamp_raw(ay >> 15);
+        out[n_out].z = clamp_raw(az >> 15);
+        out[n_out].flags = 0;
+        out[n_out].t_us = in->t_us;  // good enough, timing stats are kept on the input side
+        n_out++;
+        rs->phase += rs->M;
+    }
+    rs->phase -= rs->L;
+
+    rs->head++;
+    if (rs->head >= taps) {
+        rs->head = 0;
+    }
+    return n_out;
+}
@@ -0,0 +1,246 @@
+/* scheduler.c
+ * two level run-to-completion scheduler on a TIM3 tick, register level like timebase.c
+ *
+ * Normal tasks run from the TIM3 irq, deferred ones from PendSV at the very
+ * bottom of the priority range. Within a level nothing preempts anything, but
+ * the TIM3 level preempts the deferred one, so a long deferred task (inference)
+ * never holds up a sample. Thread mode only sleeps.
+ *
+ * The deadline stats say how long the tasks in front of it (and the irqs) held
+ * a task up, which is exactly the budget we want to see. A deferred task's run
+ * time includes whatever preempted it.
+ */
+
+#include "scheduler.h"
+#include "timebase.h"
+#include <string.h>
+#include <stddef.h>
+#ifdef HOST_BUILD
+#include "host_port.h"
+#else
+#include "stm32f4xx_hal.h"
+#include "power.h"
+#endif
+
+static SchedTask *tasks[SCHED_MAX_TASKS];
+static uint8_t num_tasks = 0;
+static volatile uint32_t ticks = 0;
+static uint32_t stats_since_us;
+static volatile uint32_t stats_epoch = 0;   // bumped on reset, so runs that straddle it get dropped
+#ifndef HOST_BUILD
+static uint32_t stopped_us = 0;             // time TIM3 sat frozen in Stop, not a whole tick yet
+#endif
+
+static inline void pend_deferred(void) {
+#ifndef HOST_BUILD
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+#endif
+}
+
+static inline void pend_dispatch(void) {
+#ifndef HOST_BUILD
+    NVIC_SetPendingIRQ(TIM3_IRQn);
+#endif
+}
+
+static void release(SchedTask *task, uint32_t now_us) {
+    if (task->released) {
+        task->stats.overruns++;
+        return;
+    }
+    task->release_us = now_us;
+    task->released = true;
+    if (task->deferred) {
+        pend_deferred();
+    }
+}
+
+static void release_periodic(uint32_t tick) {
+    uint32_t now_us = Timebase_Micros();
+    for (uint8_t i = 0; i < num_tasks; i++) {
+        SchedTask *t = tasks[i];
+        if (t->period_ms && (int32_t)(tick - t->next_tick) >= 0) {
+            // after a Stop several periods may have gone by, one release covers them
+            do {
+                t->next_tick += t->period_ms * (SCHED_TICK_HZ / 1000);
+            } while ((int32_t)(tick - t->next_tick) >= 0);
+            release(t, now_us);
+        }
+    }
+}
+
+// first released task on the level, checking the sensor style ones on the way
+static SchedTask *next_task(bool deferred) {
+    for (uint8_t i = 0; i < num_tasks; i++) {
+        SchedTask *t = tasks[i];
+        if (t->deferred != deferred) {
+            continue;
+        }
+        if (!t->released && t->ready && t->ready()) {
+            release(t, Timebase_Micros());
+        }
+        if (t->released) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void run_task(SchedTask *t) {
+    // the other level can release it again the moment the flag drops
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t release_us = t->release_us;
+    t->released = false;
+    __set_PRIMASK(primask);
+
+    uint32_t epoch = stats_epoch;
+    uint32_t start = Timebase_Micros();
+    t->run();
+    uint32_t end = Timebase_Micros();
+    if (epoch != stats_epoch) {
+        return;  // stats got reset while it ran (slept through Stop), don't count it
+    }
+
+    SchedTaskStats *s = &t->stats;
+    uint32_t latency = start - release_us;
+    uint32_t run = end - start;
+    s->runs++;
+    s->total_run_us += run;
+    if (latency > s->max_latency_us) {
+        s->max_latency_us = latency;
+    }
+    if (run > s->max_run_us) {
+        s->max_run_us = run;
+    }
+    if (end - release_us > t->deadline_us) {
+        s->deadline_misses++;
+    }
+}
+
+static void dispatch(bool deferred) {
+    SchedTask *t;
+    while ((t = next_task(deferred)) != NULL) {
+        run_task(t);
+    }
+}
+
+// 1kHz update irq off TIM3. Same prescaler maths as Timebase_Init, call it
+// again after the clocks change
+void Scheduler_ClockChanged(void) {
+#ifndef HOST_BUILD
+    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+
+    uint32_t clk = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        clk *= 2;
+    }
+
+    TIM3->CR1 = 0;
+    TIM3->PSC = clk / 1000000 - 1;
+    TIM3->ARR = 1000000 / SCHED_TICK_HZ - 1;
+    TIM3->EGR = TIM_EGR_UG;
+    TIM3->SR = ~TIM_SR_UIF;
+    TIM3->DIER = TIM_DIER_UIE;
+    TIM3->CR1 = TIM_CR1_CEN;
+
+    HAL_NVIC_SetPriority(TIM3_IRQn, SCHED_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(TIM3_IRQn);
+#endif
+}
+
+void Scheduler_Init(void) {
+    Scheduler_ClockChanged();
+#ifndef HOST_BUILD
+    HAL_NVIC_SetPriority(PendSV_IRQn, SCHED_DEFERRED_PRIORITY, 0);
+#endif
+    stats_since_us = Timebase_Micros();
+}
+
+// periodic ones get their first release one period from now
+bool Scheduler_Add(SchedTask *task) {
+    if (num_tasks >= SCHED_MAX_TASKS) {
+        return false;
+    }
+    task->released = false;
+    task->next_tick = ticks + task->period_ms * (SCHED_TICK_HZ / 1000);
+    memset(&task->stats, 0, sizeof(task->stats));
+    tasks[num_tasks++] = task;
+    return true;
+}
+
+// for tasks that get kicked by another task or an irq instead of a period.
+// false if it was still waiting on the last release
+bool Scheduler_Release(SchedTask *task) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool was_released = task->released;
+    release(task, Timebase_Micros());
+    __set_PRIMASK(primask);
+    return !was_released;
+}
+
+// thread mode: everything runs from irqs, so this just sleeps (see power.c).
+// If a sensor style task is ready it kicks the TIM3 level instead of waiting
+// out the tick
+void Scheduler_Poll(void) {
+#ifdef HOST_BUILD
+    // no irqs here. One normal task, then whatever deferred work that
+    // released, as if the deferred level ran infinitely fast underneath
+    while (ticks != HAL_GetTick()) {
+        release_periodic(++ticks);
+    }
+    SchedTask *t = next_task(false);
+    if (t) {
+        run_task(t);
+    }
+    dispatch(true);
+    if (!t) {
+        __WFI();
+    }
+#else
+    // irqs masked so a release landing between the check and the WFI still wakes us
+    __disable_irq();
+    if (next_task(false)) {
+        pend_dispatch();
+    } else {
+        // TIM3 doesn't tick in Stop, make up the ticks it missed
+        stopped_us += Power_Idle();
+        if (stopped_us >= 1000000 / SCHED_TICK_HZ) {
+            ticks += stopped_us / (1000000 / SCHED_TICK_HZ);
+            stopped_us %= 1000000 / SCHED_TICK_HZ;
+            release_periodic(ticks);
+        }
+    }
+    __enable_irq();
+#endif
+}
+
+void Scheduler_ResetStats(void) {
+    for (uint8_t i = 0; i < num_tasks; i++) {
+        memset(&tasks[i]->stats, 0, sizeof(SchedTaskStats));
+    }
+    stats_since_us = Timebase_Micros();
+    stats_epoch++;
+}
+
+// wall time the current stats cover, for turning total_run_us into a load
+uint32_t Scheduler_StatsElapsedUs(void) {
+    return Timebase_Micros() - stats_since_us;
+}
+
+// TIM3 irq: either a tick, or Scheduler_Poll kicking us because something's ready
+void Scheduler_TickIRQ(void) {
+#ifndef HOST_BUILD
+    if (TIM3->SR & TIM_SR_UIF) {
+        TIM3->SR = ~TIM_SR_UIF;
+        release_periodic(++ticks);
+    }
+    dispatch(false);
+#endif
+}
+
+// PendSV
+void Scheduler_DeferredIRQ(void) {
+    dispatch(true);
+}
@@ -0,0 +1,73 @@
+/* sensor_lsm303.c
+ * SensorBackend for the on board LSM303, a thin layer over accelerometer.c
+ * that hides which ACCEL_ACQ_MODE it was built with
+ */
+
+#include "sensor.h"
+
+#if SENSOR_BACKEND == SENSOR_BACKEND_LSM303
+
+#include "stm32f4xx_hal.h"
+
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+static uint32_t accel_timer = 0;
+static bool accel_timer_started = false;
+static uint32_t polled_missed = 0;  // whole periods that went by without a read
+#endif
+
+static bool lsm303_data_ready(void) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+    // nothing tells us, just go once per sensor period off the 1ms tick
+    // (10ms at 100hz, the speed we trained the model with)
+    return HAL_GetTick() - accel_timer >= 1000 / Accel_GetODR();
+#else
+    return Accel_DataReady();
+#endif
+}
+
+static uint8_t lsm303_read(AccelRawData *data, uint8_t max) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_FIFO
+    return Accel_ReadFifo(data, max);
+#else
+    (void)max;
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+    // next read is due a period after this one was, not after now, so a late
+    // read doesn't push every one after it late too. Later than a whole extra
+    // period and those conversions are gone (one output register), count them
+    // and start over from now
+    uint32_t now = HAL_GetTick();
+    uint32_t period = 1000 / Accel_GetODR();
+    if (!accel_timer_started) {
+        accel_timer = now;
+        accel_timer_started = true;
+    } else if (now - accel_timer >= 2 * period) {
+        polled_missed += (now - accel_timer) / period - 1;
+        accel_timer = now;
+    } else {
+        accel_timer += period;
+    }
+#endif
+    return Accel_ReadRaw(data) ? 1 : 0;
+#endif
+}
+
+static uint32_t lsm303_get_missed(void) {
+#if ACCEL_ACQ_MODE == ACCEL_ACQ_POLLED
+    return Accel_GetMissedConversions() + polled_missed;
+#else
+    return Accel_GetMissedConversions();
+#endif
+}
+
+const SensorBackend sensor_lsm303 = {
+    .name = "LSM303",
+    .init = Accel_Init,
+    .data_ready = lsm303_data_ready,
+    .read = lsm303_read,
+    .get_odr = Accel_GetODR,
+    .set_odr = Accel_SetODR,
+    .get_missed = lsm303_get_missed,
+    .finished = NULL,
+};
+
+#endif
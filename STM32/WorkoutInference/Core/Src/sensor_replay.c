@@ -0,0 +1,134 @@
+/* sensor_replay.c
+ * SensorBackend that plays back a recorded TrainingDataEAI/<run>/WatchAccelerometerUncalibrated.csv
+ * (time,seconds_elapsed,x,y,z in g) so the whole main.c loop can run and be
+ * timed on a PC against data we know the answer for. Host builds only.
+ *
+ *   REPLAY_CSV=path/to/WatchAccelerometerUncalibrated.csv   the recording, required
+ *   REPLAY_SPEED=1     1 = as recorded, 10 = ten times faster, 0 = flat out
+ *
+ * Samples come out stamped with the recording's own clock, so the jitter
+ * stats and the 1s inference spacing follow the data and not the PC, whatever
+ * the speed. The g values get turned into the same 12 bit counts the LSM303
+ * gives us at ±8g.
+ */
+
+#include "sensor.h"
+
+#if SENSOR_BACKEND == SENSOR_BACKEND_REPLAY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "timebase.h"
+
+// the watch logs at a nominal 100Hz (really ~99.8)
+#ifndef REPLAY_ODR_HZ
+#define REPLAY_ODR_HZ   100
+#endif
+
+static FILE *csv = NULL;
+static float speed = 1.0f;
+static uint32_t first_us;        // recording time of the first sample
+static uint32_t start_us;        // our clock when it got played
+static bool started = false;
+
+// one row read ahead, so data_ready knows when the next one is due
+static AccelRawData next;
+static bool have_next = false;
+static uint32_t bad_rows = 0;
+
+static int16_t g_to_counts(float g) {
+    long c = lrintf(g * ACCEL_COUNTS_PER_G);
+    if (c < ACCEL_RAW_MIN) c = ACCEL_RAW_MIN;
+    if (c > ACCEL_RAW_MIN + ACCEL_RAW_COUNT - 1) c = ACCEL_RAW_MIN + ACCEL_RAW_COUNT - 1;
+    return (int16_t)c;
+}
+
+// next good row into next, skipping (and counting) anything that doesn't parse
+static void load_next(void) {
+    char line[160];
+    have_next = false;
+    while (fgets(line, sizeof(line), csv)) {
+        double t;
+        float x, y, z;
+        if (sscanf(line, "%*[^,],%lf,%f,%f,%f", &t, &x, &y, &z) != 4) {
+            bad_rows++;
+            continue;
+        }
+        next.x = g_to_counts(x);
+        next.y = g_to_counts(y);
+        next.z = g_to_counts(z);
+        next.flags = 0;
+        next.t_us = (uint32_t)(uint64_t)llround(t * 1e6);
+        have_next = true;
+        return;
+    }
+}
+
+static bool due(void) {
+    if (!started) {
+        started = true;
+        first_us = next.t_us;
+        start_us = Timebase_Micros();
+    }
+    if (speed <= 0.0f) {
+        return true;
+    }
+    return (float)(Timebase_Micros() - start_us) * speed >= (float)(next.t_us - first_us);
+}
+
+static bool replay_init(void) {
+    const char *path = getenv("REPLAY_CSV");
+    const char *s = getenv("REPLAY_SPEED");
+    if (s) {
+        speed = strtof(s, NULL);
+    }
+    if (!path || !(csv = fopen(path, "r"))) {
+        fprintf(stderr, "replay: can't open REPLAY_CSV=%s\n", path ? path : "(unset)");
+        return false;
+    }
+    char header[80];
+    if (!fgets(header, sizeof(header), csv)) {
+        return false;
+    }
+    load_next();
+    return have_next;
+}
+
+static bool replay_data_ready(void) {
+    return have_next && due();
+}
+
+static uint8_t replay_read(AccelRawData *data, uint8_t max) {
+    uint8_t n = 0;
+    while (n < max && have_next && due()) {
+        data[n++] = next;
+        load_next();
+    }
+    return n;
+}
+
+static uint16_t replay_get_odr(void) {
+    return REPLAY_ODR_HZ;
+}
+
+static uint32_t replay_get_missed(void) {
+    return bad_rows;
+}
+
+static bool replay_finished(void) {
+    return !have_next;
+}
+
+const SensorBackend sensor_replay = {
+    .name = "CSV replay",
+    .init = replay_init,
+    .data_ready = replay_data_ready,
+    .read = replay_read,
+    .get_odr = replay_get_odr,
+    .set_odr = NULL,
+    .get_missed = replay_get_missed,
+    .finished = replay_finished,
+};
+
+#endif
@@ -22,6 +22,10 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "i2c_engine.h"
+#include "timebase.h"
+#include "scheduler.h"
+#include "power.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -57,6 +61,10 @@
 /* External variables --------------------------------------------------------*/
 extern HCD_HandleTypeDef hhcd_USB_OTG_FS;
 /* USER CODE BEGIN EV */
+extern DMA_HandleTypeDef hdma_i2c1_rx;
+extern SPI_HandleTypeDef hspi1;
+extern DMA_HandleTypeDef hdma_spi1_rx;
+extern DMA_HandleTypeDef hdma_spi1_tx;
 
 /* USER CODE END EV */
 
@@ -170,7 +178,7 @@ void DebugMon_Handler(void)
 void PendSV_Handler(void)
 {
   /* USER CODE BEGIN PendSV_IRQn 0 */
-
+  Scheduler_DeferredIRQ();
   /* USER CODE END PendSV_IRQn 0 */
   /* USER CODE BEGIN PendSV_IRQn 1 */
 
@@ -214,4 +222,84 @@ void OTG_FS_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles EXTI line4 interrupt (LSM303DLHC INT1).
+  */
+void EXTI4_IRQHandler(void)
+{
+  HAL_GPIO_EXTI_IRQHandler(INT1_Pin);
+}
+
+/**
+  * @brief This function handles EXTI line3 interrupt (USART2 RX edge, Stop wakeup).
+  */
+void EXTI3_IRQHandler(void)
+{
+  Power_RxWakeIRQ();
+}
+
+/**
+  * @brief This function handles DMA1 stream0 global interrupt (I2C1 RX).
+  */
+void DMA1_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_i2c1_rx);
+}
+
+/**
+  * @brief This function handles I2C1 event interrupt.
+  */
+void I2C1_EV_IRQHandler(void)
+{
+  I2CEngine_EventIRQ();
+}
+
+/**
+  * @brief This function handles I2C1 error interrupt.
+  */
+void I2C1_ER_IRQHandler(void)
+{
+  I2CEngine_ErrorIRQ();
+}
+
+/**
+  * @brief This function handles TIM2 global interrupt (timebase alarm).
+  */
+void TIM2_IRQHandler(void)
+{
+  Timebase_AlarmIRQ();
+}
+
+/**
+  * @brief This function handles TIM3 global interrupt (scheduler tick).
+  */
+void TIM3_IRQHandler(void)
+{
+  Scheduler_TickIRQ();
+}
+
+/**
+  * @brief This function handles DMA2 stream0 global interrupt (SPI1 RX).
+  */
+void DMA2_Stream0_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi1_rx);
+}
+
+/**
+  * @brief This function handles DMA2 stream3 global interrupt (SPI1 TX).
+  */
+void DMA2_Stream3_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_spi1_tx);
+}
+
+/**
+  * @brief This function handles SPI1 global interrupt.
+  */
+void SPI1_IRQHandler(void)
+{
+  HAL_SPI_IRQHandler(&hspi1);
+}
+
 /* USER CODE END 1 */
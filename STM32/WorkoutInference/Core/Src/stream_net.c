@@ -0,0 +1,327 @@
+/* stream_net.c
+ * streaming version of the generated network:
+ *   depthwise conv k=3 (same padding) -> pointwise 3->8 + relu -> max-pool 5
+ *   -> mean over the 40 pool outputs -> dense 8->6
+ *
+ * Conv output t needs samples t-1..t+1, so it gets computed when sample t+1
+ * comes in, with the real neighbours. Only the window's first and last
+ * outputs see the padding instead, those two get redone at each
+ * classification from inputs kept for them. Pool blocks are kept as the max
+ * over all 5, over all but the first and over all but the last, so the two
+ * edge blocks can be put back together with their padded outputs, and the
+ * mean's sum runs over the finished blocks.
+ *
+ * Requantization is TFLite's (Q31 multiplier, rounding doubling high mul,
+ * rounding shift). The ST runtime isn't open, so how close it comes to that is
+ * what SampleStats.stream_mismatches is for. Pool blocks line up with the
+ * window's start, so a classification is only ready every STREAM_POOL samples.
+ */
+
+#include "stream_net.h"
+
+#if WORKOUT_STREAMING
+
+#include "ramfunc.h"
+#include <string.h>
+#include <math.h>
+
+#include "ai_platform.h"
+#include "network_data.h"
+
+// layout and quant params of the generated network (network.c,
+// network_configure_weights and the *_intq tables). A regenerated network
+// moves them, the size check at least catches that
+#if AI_NETWORK_DATA_WEIGHTS_SIZE != 152 || NUM_FEATURES != 3 || STREAM_POOL != 5
+#error "the network changed, redo the offsets and scales in stream_net.c (or turn off WORKOUT_STREAMING)"
+#endif
+
+#define W_DW            0       // int8 [3 taps][3 ch]
+#define W_DW_BIAS       12      // int32 [3]
+#define W_PW            24      // int8 [8 out][3 in]
+#define W_PW_BIAS       48      // int32 [8]
+#define W_FC            80      // int8 [6 out][8 in]
+#define W_FC_BIAS       128     // int32 [6]
+
+#define IN_SCALE        0.07087875157594681f
+#define IN_ZP           2
+#define DW_SCALE        0.17976555228233337f
+#define DW_ZP           (-9)
+#define PW_SCALE        0.17518994212150574f    // pool_6 is the same
+#define PW_ZP           (-128)
+#define MEAN_SCALE      0.06390472501516342f
+#define MEAN_ZP         (-128)
+#define FC_SCALE        0.17285418510437012f
+#define FC_ZP           73
+#define OUT_ZP          201     // conversion_10, same scale as the dense
+
+static const float dw_w_scale[3] = {
+    0.012144627049565315f, 0.010448218323290348f, 0.01148257590830326f
+};
+static const float pw_w_scale[STREAM_CHANNELS] = {
+    0.010516667738556862f, 0.010691334493458271f, 0.008318031206727028f, 0.011356295086443424f,
+    0.011039777658879757f, 0.007297290023416281f, 0.006963254418224096f, 0.007746930234134197f
+};
+static const float fc_w_scale[NUM_CLASSES] = {
+    0.008200470358133316f, 0.011252210475504398f, 0.011122921481728554f,
+    0.006822310853749514f, 0.006939350627362728f, 0.009045187383890152f
+};
+
+typedef struct {
+    int32_t mult;
+    int32_t shift;      // > 0 left, < 0 right
+} Requant;
+
+typedef struct {
+    int8_t all[STREAM_CHANNELS];    // max of the block's 5 outputs
+    int8_t tail[STREAM_CHANNELS];   // of the last 4, the block starting a window swaps its first for the padded one
+    int8_t head[STREAM_CHANNELS];   // of the first 4, same for the block ending one
+    int8_t first[2][3];             // inputs at the block's first two samples, for that padded output
+} PoolBlock;
+
+// weights
+static const int8_t *dw_w;
+static const int8_t *pw_w;
+static const int8_t *fc_w;
+static int32_t dw_bias[3];
+static int32_t pw_bias[STREAM_CHANNELS];
+static int32_t fc_bias[NUM_CLASSES];
+static Requant dw_rq[3];
+static Requant pw_rq[STREAM_CHANNELS];
+static Requant fc_rq[NUM_CLASSES];
+static Requant mean_rq;
+
+// running state. One block more than a window, the one leaving the sum is
+// still needed until the block replacing it is done
+static PoolBlock blocks[STREAM_BLOCKS + 1];
+static int32_t block_sum[STREAM_CHANNELS];     // .all over the window's finished blocks
+static int8_t last_in[2][3];                    // the two newest inputs, oldest first
+static uint32_t count;                          // samples pushed since the reset
+
+// TFLite's QuantizeMultiplier, in double like it so the multipliers come out identical
+static Requant make_requant(double real) {
+    Requant rq = {0, 0};
+    if (real <= 0.0) {
+        return rq;
+    }
+    int exp;
+    double frac = frexp(real, &exp);
+    int64_t q = (int64_t)llround(frac * (double)(1LL << 31));
+    if (q == (1LL << 31)) {
+        q /= 2;
+        exp++;
+    }
+    rq.mult = (int32_t)q;
+    rq.shift = exp;
+    return rq;
+}
+
+static inline int32_t requant(int32_t x, Requant rq) {
+    if (rq.shift > 0) {
+        x <<= rq.shift;
+    }
+    // rounding doubling high multiply (the INT32_MIN * INT32_MIN case can't happen, mult > 0)
+    int64_t ab = (int64_t)x * rq.mult;
+    int64_t nudge = (ab >= 0) ? (1LL << 30) : (1 - (1LL << 30));
+    int32_t high = (int32_t)((ab + nudge) / (1LL << 31));
+    if (rq.shift >= 0) {
+        return high;
+    }
+    // rounding arithmetic right shift, halves away from zero
+    int32_t exp = -rq.shift;
+    int32_t mask = (1 << exp) - 1;
+    int32_t rem = high & mask;
+    int32_t threshold = (mask >> 1) + (high < 0 ? 1 : 0);
+    return (high >> exp) + (rem > threshold ? 1 : 0);
+}
+
+static inline int8_t clamp_s8(int32_t v) {
+    return (int8_t)(v < -128 ? -128 : (v > 127 ? 127 : v));
+}
+
+static inline int32_t read_s32(const uint8_t *w, uint32_t offset, uint32_t i) {
+    int32_t v;
+    memcpy(&v, w + offset + i * 4, 4);
+    return v;
+}
+
+// window code -> the network's int8 input
+static inline int8_t code_to_s8(uint8_t code) {
+    return (int8_t)(code ^ INPUT_CODE_FLIP ^ 0x80);
+}
+
+// one conv output from the inputs either side of it and its own, NULL for padding
+RAMFUNC static void conv_at(const int8_t *prev, const int8_t *cur, const int8_t *next,
+                            int8_t out[STREAM_CHANNELS]) {
+    int32_t d[3];
+    for (uint8_t c = 0; c < 3; c++) {
+        int32_t acc = dw_bias[c] + dw_w[3 + c] * (cur[c] - IN_ZP);
+        if (prev) {
+            acc += dw_w[c] * (prev[c] - IN_ZP);
+        }
+        if (next) {
+            acc += dw_w[6 + c] * (next[c] - IN_ZP);
+        }
+        d[c] = clamp_s8(requant(acc, dw_rq[c]) + DW_ZP) - DW_ZP;
+    }
+    for (uint8_t o = 0; o < STREAM_CHANNELS; o++) {
+        const int8_t *w = &pw_w[o * 3];
+        int32_t acc = pw_bias[o] + w[0] * d[0] + w[1] * d[1] + w[2] * d[2];
+        out[o] = clamp_s8(requant(acc, pw_rq[o]) + PW_ZP);    // relu is the clamp at PW_ZP
+    }
+}
+
+// mean of the pool outputs (given as their sum) through the dense layer
+static void classify_sum(const int32_t sum[STREAM_CHANNELS], uint8_t out[NUM_CLASSES]) {
+    int32_t mean[STREAM_CHANNELS];
+    for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+        int32_t acc = requant(sum[c] - STREAM_BLOCKS * PW_ZP, mean_rq);
+        acc = (acc > 0) ? (acc + STREAM_BLOCKS / 2) / STREAM_BLOCKS : (acc - STREAM_BLOCKS / 2) / STREAM_BLOCKS;
+        mean[c] = clamp_s8(acc + MEAN_ZP) - MEAN_ZP;
+    }
+    for (uint8_t j = 0; j < NUM_CLASSES; j++) {
+        const int8_t *w = &fc_w[j * STREAM_CHANNELS];
+        int32_t acc = fc_bias[j];
+        for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+            acc += w[c] * mean[c];
+        }
+        out[j] = (uint8_t)(clamp_s8(requant(acc, fc_rq[j]) + FC_ZP) + (OUT_ZP - FC_ZP));
+    }
+}
+
+// weights straight out of the network's blob, multipliers worked out once
+bool StreamNet_Init(void) {
+    const ai_handle *table = (const ai_handle *)ai_network_data_weights_get();
+    const uint8_t *w = (const uint8_t *)table[1];
+    if (w == NULL) {
+        return false;
+    }
+
+    dw_w = (const int8_t *)(w + W_DW);
+    pw_w = (const int8_t *)(w + W_PW);
+    fc_w = (const int8_t *)(w + W_FC);
+    for (uint8_t c = 0; c < 3; c++) {
+        dw_bias[c] = read_s32(w, W_DW_BIAS, c);
+        dw_rq[c] = make_requant((double)IN_SCALE * dw_w_scale[c] / DW_SCALE);
+    }
+    for (uint8_t o = 0; o < STREAM_CHANNELS; o++) {
+        pw_bias[o] = read_s32(w, W_PW_BIAS, o);
+        pw_rq[o] = make_requant((double)DW_SCALE * pw_w_scale[o] / PW_SCALE);
+    }
+    for (uint8_t j = 0; j < NUM_CLASSES; j++) {
+        fc_bias[j] = read_s32(w, W_FC_BIAS, j);
+        fc_rq[j] = make_requant((double)MEAN_SCALE * fc_w_scale[j] / FC_SCALE);
+    }
+    mean_rq = make_requant((double)PW_SCALE / MEAN_SCALE);
+
+    StreamNet_Reset();
+    return true;
+}
+
+// the window starts over, nothing's ready until BUFFER_SIZE more samples
+void StreamNet_Reset(void) {
+    memset(block_sum, 0, sizeof(block_sum));
+    count = 0;
+}
+
+// one sample's accel codes at the model's rate, same ones that go in the window
+RAMFUNC void StreamNet_Push(const uint8_t codes[3]) {
+    int8_t in[3] = { code_to_s8(codes[0]), code_to_s8(codes[1]), code_to_s8(codes[2]) };
+
+    if (count > 0) {
+        // the previous sample's output has both its neighbours now
+        uint32_t t = count - 1;
+        int8_t y[STREAM_CHANNELS];
+        conv_at(t > 0 ? last_in[0] : NULL, last_in[1], in, y);
+
+        uint32_t k = t / STREAM_POOL;
+        uint8_t pos = t % STREAM_POOL;
+        PoolBlock *b = &blocks[k % (STREAM_BLOCKS + 1)];
+        if (pos == 0) {
+            memcpy(b->all, y, STREAM_CHANNELS);
+            memcpy(b->head, y, STREAM_CHANNELS);
+            memset(b->tail, -128, STREAM_CHANNELS);
+            memcpy(b->first[0], last_in[1], 3);
+            memcpy(b->first[1], in, 3);
+        } else {
+            for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+                if (y[c] > b->all[c]) b->all[c] = y[c];
+                if (y[c] > b->tail[c]) b->tail[c] = y[c];
+                if (pos < STREAM_POOL - 1 && y[c] > b->head[c]) b->head[c] = y[c];
+            }
+        }
+
+        if (pos == STREAM_POOL - 1) {
+            // block done, and the one a window back leaves the sum
+            const PoolBlock *gone = (k >= STREAM_BLOCKS - 1) ? &blocks[(k + 2) % (STREAM_BLOCKS + 1)] : NULL;
+            for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+                block_sum[c] += b->all[c] - (gone ? gone->all[c] : 0);
+            }
+        }
+    }
+
+    memcpy(last_in[0], last_in[1], 3);
+    memcpy(last_in[1], in, 3);
+    count++;
+}
+
+// a whole window's in and it starts on a pool block boundary
+bool StreamNet_Ready(void) {
+    return count >= BUFFER_SIZE && count % STREAM_POOL == 0;
+}
+
+// scores for the window ending with the last sample pushed, as the network's
+// uint8 output. Only right when StreamNet_Ready
+RAMFUNC void StreamNet_Classify(uint8_t out[NUM_CLASSES]) {
+    uint32_t last = count / STREAM_POOL - 1;
+    const PoolBlock *b0 = &blocks[(last + 2) % (STREAM_BLOCKS + 1)];   // last - 39
+    const PoolBlock *bn = &blocks[last % (STREAM_BLOCKS + 1)];
+
+    // the window's first and last outputs see the padding
+    int8_t y0[STREAM_CHANNELS];
+    int8_t yn[STREAM_CHANNELS];
+    conv_at(NULL, b0->first[0], b0->first[1], y0);
+    conv_at(last_in[0], last_in[1], NULL, yn);
+
+    // block_sum has every block but the one still going, swap the first
+    // block's max for its padded version and add the last one
+    int32_t sum[STREAM_CHANNELS];
+    for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+        int8_t first = (y0[c] > b0->tail[c]) ? y0[c] : b0->tail[c];
+        int8_t end = (yn[c] > bn->head[c]) ? yn[c] : bn->head[c];
+        sum[c] = block_sum[c] - b0->all[c] + first + end;
+    }
+    classify_sum(sum, out);
+}
+
+#ifdef HOST_BUILD
+// the same network on one straight window, every output from scratch like
+// the generated one does it. What the streaming gets checked against off the
+// board, on it WORKOUT_STREAM_CHECK uses the real network instead
+void StreamNet_RunWindow(const uint8_t window[][NUM_FEATURES], uint8_t out[NUM_CLASSES]) {
+    int32_t sum[STREAM_CHANNELS] = {0};
+    int8_t in[3][3];
+    int8_t pool[STREAM_CHANNELS];
+
+    for (uint16_t t = 0; t < BUFFER_SIZE; t++) {
+        for (uint8_t c = 0; c < 3; c++) {
+            if (t > 0) in[0][c] = code_to_s8(window[t - 1][c]);
+            in[1][c] = code_to_s8(window[t][c]);
+            if (t < BUFFER_SIZE - 1) in[2][c] = code_to_s8(window[t + 1][c]);
+        }
+        int8_t y[STREAM_CHANNELS];
+        conv_at(t > 0 ? in[0] : NULL, in[1], t < BUFFER_SIZE - 1 ? in[2] : NULL, y);
+
+        for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+            if (t % STREAM_POOL == 0 || y[c] > pool[c]) pool[c] = y[c];
+        }
+        if (t % STREAM_POOL == STREAM_POOL - 1) {
+            for (uint8_t c = 0; c < STREAM_CHANNELS; c++) {
+                sum[c] += pool[c];
+            }
+        }
+    }
+    classify_sum(sum, out);
+}
+#endif
+
+#endif
@@ -23,12 +23,18 @@
 /* Includes */
 #include <errno.h>
 #include <stdint.h>
+#include "memwatch.h"
 
 /**
  * Pointer to the current high watermark of the heap usage
  */
 static uint8_t *__sbrk_heap_end = NULL;
 
+/**
+ * _sbrk requests turned down for running into the stack (memwatch.h)
+ */
+static uint32_t __sbrk_failures = 0;
+
 /**
  * @brief _sbrk() allocates memory to the newlib heap and is used by malloc
  *        and others from the C library
@@ -68,6 +74,7 @@ void *_sbrk(ptrdiff_t incr)
   /* Protect heap from growing into the reserved MSP stack */
   if (__sbrk_heap_end + incr > max_heap)
   {
+    __sbrk_failures++;
     errno = ENOMEM;
     return (void *)-1;
   }
@@ -77,3 +84,17 @@ void *_sbrk(ptrdiff_t incr)
 
   return (void *)prev_heap_end;
 }
+
+/**
+ * @brief bytes handed out to the heap so far, it never gives any back
+ */
+uint32_t Sysmem_HeapUsed(void)
+{
+  extern uint8_t _end; /* Symbol defined in the linker script */
+  return (NULL == __sbrk_heap_end) ? 0 : (uint32_t)(__sbrk_heap_end - &_end);
+}
+
+uint32_t Sysmem_HeapFailures(void)
+{
+  return __sbrk_failures;
+}
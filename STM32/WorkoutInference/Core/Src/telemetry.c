@@ -0,0 +1,60 @@
+/* telemetry.c
+ * doesn't count anything itself, it pulls together what the sample stats,
+ * the scheduler, the sensor driver and the UART already keep
+ */
+
+#include <stdio.h>
+#include "telemetry.h"
+#include "workout_inference.h"
+#include "uart.h"
+
+static const SchedTask *acquire_task;
+static const SchedTask *infer_task;
+static uint32_t (*get_driver_missed)(void);
+
+// the UART's count never resets, this is where it stood at the last reset
+static uint32_t uart_blocked_base;
+
+void Telemetry_Init(const SchedTask *acquire, const SchedTask *infer, uint32_t (*driver_missed)(void)) {
+    acquire_task = acquire;
+    infer_task = infer;
+    get_driver_missed = driver_missed;
+    Telemetry_Reset();
+}
+
+void Telemetry_Get(TelemetrySummary *out) {
+    SampleStats stats;
+    Workout_GetSampleStats(&stats);
+
+    out->samples_missed = stats.gap_missed + stats.overruns + stats.lost
+                        + (get_driver_missed ? get_driver_missed() : 0);
+    out->hops_skipped = stats.hops_skipped;
+    out->acquire_late = acquire_task->stats.deadline_misses;
+    out->infer_late = infer_task->stats.deadline_misses + stats.windows_overrun;
+    out->max_latency_us = acquire_task->stats.max_latency_us;
+    if (infer_task->stats.max_latency_us > out->max_latency_us) {
+        out->max_latency_us = infer_task->stats.max_latency_us;
+    }
+    out->uart_blocked_us = UART_GetBlockedUs() - uart_blocked_base;
+    out->elapsed_us = Scheduler_StatsElapsedUs();
+}
+
+// compact enough to leave running: TLM <seconds> miss <n>/<late> infer <late>/<skipped> lat <us> uart <ms>
+void Telemetry_Print(void) {
+    TelemetrySummary t;
+    Telemetry_Get(&t);
+
+    uint32_t uart = t.elapsed_us ? (uint32_t)((uint64_t)t.uart_blocked_us * 1000 / t.elapsed_us) : 0;
+    char buf[200];
+    sprintf(buf, "TLM %lus miss %lu/%lu late, infer %lu late/%lu skipped, lat %lu us, uart %lu ms (%lu.%lu%%)\r\n",
+            (unsigned long)(t.elapsed_us / 1000000), (unsigned long)t.samples_missed,
+            (unsigned long)t.acquire_late, (unsigned long)t.infer_late, (unsigned long)t.hops_skipped,
+            (unsigned long)t.max_latency_us, (unsigned long)(t.uart_blocked_us / 1000),
+            (unsigned long)(uart / 10), (unsigned long)(uart % 10));
+    sendString(buf);
+}
+
+// with the sample and scheduler stats, so everything covers the same stretch
+void Telemetry_Reset(void) {
+    uart_blocked_base = UART_GetBlockedUs();
+}
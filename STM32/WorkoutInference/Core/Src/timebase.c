@@ -0,0 +1,65 @@
+/* timebase.c
+ * free running microsecond clock off TIM2, register level like uart.c
+ * (the HAL TIM module isn't pulled into this project)
+ */
+
+#include "timebase.h"
+#include "stm32f4xx_hal.h"
+#include <stddef.h>
+
+static void (*volatile alarm_callback)(void) = NULL;
+
+// (re)derives the prescaler from the current APB1 clock, so call it again
+// after changing clocks. The count carries on from where it was
+void Timebase_Init(void) {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+
+    // timers on APB1 run at 2x PCLK1 whenever APB1 is divided down
+    uint32_t clk = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        clk *= 2;
+    }
+
+    uint32_t cnt = TIM2->CNT;
+    TIM2->CR1 = 0;
+    TIM2->PSC = clk / 1000000 - 1;  // 1MHz tick
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->EGR = TIM_EGR_UG;         // latch the new prescaler now (zeroes CNT)
+    TIM2->CNT = cnt;
+    TIM2->CR1 = TIM_CR1_CEN;
+
+    HAL_NVIC_SetPriority(TIM2_IRQn, TIMEBASE_IRQ_PRIORITY, 0);
+    HAL_NVIC_EnableIRQ(TIM2_IRQn);
+}
+
+// calls callback from the TIM2 irq once the clock hits at_us (one alarm at a time,
+// a new one replaces the old). Has to be less than ~71 minutes out
+void Timebase_SetAlarm(uint32_t at_us, void (*callback)(void)) {
+    TIM2->DIER &= ~TIM_DIER_CC1IE;
+    alarm_callback = callback;
+    TIM2->CCR1 = at_us;
+    TIM2->SR = ~TIM_SR_CC1IF;
+    TIM2->DIER |= TIM_DIER_CC1IE;
+}
+
+void Timebase_CancelAlarm(void) {
+    TIM2->DIER &= ~TIM_DIER_CC1IE;
+    alarm_callback = NULL;
+}
+
+void Timebase_AlarmIRQ(void) {
+    if (!(TIM2->SR & TIM_SR_CC1IF)) {
+        return;
+    }
+    TIM2->SR = ~TIM_SR_CC1IF;
+    if (!(TIM2->DIER & TIM_DIER_CC1IE)) {
+        return;  // compare still matches while disarmed, just not our business
+    }
+    TIM2->DIER &= ~TIM_DIER_CC1IE;
+
+    void (*callback)(void) = alarm_callback;
+    alarm_callback = NULL;
+    if (callback) {
+        callback();
+    }
+}
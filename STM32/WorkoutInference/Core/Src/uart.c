@@ -6,9 +6,15 @@
  */
 
 #include "uart.h"
+#include "timebase.h"
+#include "energy.h"
 #include <stdarg.h>
 #include <stdio.h>
 
+// time spent spinning on a full TX register, i.e. printing holding up
+// whoever printed. Rough, a print that preempts another one counts twice
+static uint32_t blocked_us = 0;
+
 /////////////// UART
 
 // Blocking RX
@@ -19,10 +25,18 @@ int getchar_polled(void) {
 
 // Blocking TX
 void putchar_polled(int c) {
-    while (!(USART2->SR & USART_SR_TXE));
+    if (!(USART2->SR & USART_SR_TXE)) {
+        uint32_t start = Timebase_Micros();
+        while (!(USART2->SR & USART_SR_TXE));
+        blocked_us += Timebase_Micros() - start;
+    }
     USART2->DR = c;
 }
 
+uint32_t UART_GetBlockedUs(void) {
+    return blocked_us;
+}
+
 // Non-blocking RX - returns -1 if no data available
 int getchar_nonblocking(void) {
     if (USART2->SR & USART_SR_RXNE) {
@@ -34,9 +48,11 @@ int getchar_nonblocking(void) {
 /////////// SENDING STRINGS OUT
 
 void sendString(const char *str) {
+    Energy_Begin(ENERGY_UART);
     while (*str) {
     	putchar_polled(*str++);
     }
+    Energy_End();
 }
 
 void sendStringGreen(const char *str){
@@ -51,6 +67,12 @@ void sendCharGreen(uint8_t ch) {
     sendString(ANSI_RESET);
 }
 
+// USART2 is on APB1, BRR has to follow PCLK1 (clock.c changes it on the fly)
+void UART_ClockChanged(void) {
+    uint32_t pclk = HAL_RCC_GetPCLK1Freq();
+    USART2->BRR = (pclk + UART_BAUD / 2) / UART_BAUD;
+}
+
 void UART_Init(void)
 {
     // clock enable for USART2 and GPIOA
@@ -72,8 +94,7 @@ void UART_Init(void)
     USART2->CR1 &= ~USART_CR1_UE;
 
     // Set baud rate to 115200
-    // USART2 is on APB1
-    USART2->BRR = 0xD9;
+    UART_ClockChanged();
 
     // UART settings
     // 8 data bits, 1 stop bit, no parity
@@ -13,7 +13,14 @@
 
 #include "uart.h"
 #include "workout_inference.h"
+#include "resampler.h"
+#include "ramfunc.h"
+#include "stream_net.h"
 #include <string.h>
+#include <stddef.h>
+#ifdef HOST_BUILD
+#include "host_port.h"
+#endif
 
 // X-CUBE-AI generates these
 #include "ai_datatypes_defines.h"
@@ -21,10 +28,137 @@
 #include "network.h"
 #include "network_data.h"
 
-// the circular accel data buffer
-static AccelBuffer accel_buf;
+#if NUM_FEATURES != AI_NETWORK_IN_1_CHANNEL
+#error "NUM_FEATURES doesn't match the network's input channels, regenerate the network (or flip WORKOUT_USE_GYRO)"
+#endif
+
+#if WORKOUT_INPUT_IN_ACTIVATIONS && !defined(AI_NETWORK_INPUTS_IN_ACTIVATIONS)
+#error "the network wasn't generated with allocate-inputs, there's no input in the activations to write to"
+#endif
+
+#if WORKOUT_WARM_RESTART
+#define NOINIT          __attribute__((section(".noinit")))
+// "WKWR", a window of the other encoding or a hop streaming can't take isn't ours
+#define WARM_MAGIC      (0x574B5752u ^ INPUT_CODE_FLIP ^ (HOP_STEP_SAMPLES << 8))
+#else
+#define NOINIT
+#endif
+
+// the circular accel data buffer, left alone by a reset
+static AccelBuffer accel_buf NOINIT;
 static uint32_t sample_count = 0;
 
+// inference trigger, in samples at SAMPLE_RATE_HZ so it follows the data and
+// not the wall clock (a sped up replay still gets one per hop of recording)
+static uint16_t hop_samples = WORKOUT_HOP_MS * SAMPLE_RATE_HZ / 1000;
+static uint32_t samples_since_snapshot = 0;
+static uint16_t input_hz = SAMPLE_RATE_HZ;
+
+#if WORKOUT_WARM_RESTART
+// everything past the window that it takes to carry on after a reset. crc
+// (the CRC unit) covers the rest of the struct. The window itself gets a
+// position weighted sum that store_sample keeps current in a couple of adds,
+// a CRC over all 600 bytes every sample would cost more than the sample does
+typedef struct {
+    uint32_t magic;
+    uint32_t sum;                       // every window byte
+    uint32_t wsum;                      // every byte times (its offset + 1), catches moved bytes
+    uint32_t sample_count;
+    uint32_t samples_since_snapshot;
+    uint16_t write_idx;
+    uint16_t filled;
+    uint16_t hop_samples;
+    uint16_t input_hz;
+    uint32_t crc;
+} WarmState;
+
+static WarmState warm NOINIT;
+static bool warm_started = false;
+
+static uint32_t warm_crc(void) {
+    CRC->CR = CRC_CR_RESET;
+    const uint32_t *w = (const uint32_t *)&warm;
+    for (uint32_t i = 0; i < offsetof(WarmState, crc) / 4; i++) {
+        CRC->DR = w[i];
+    }
+    return CRC->DR;
+}
+
+// brings warm up to date with the live state, after anything that changes it
+static void warm_seal(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    warm.magic = WARM_MAGIC;
+    warm.sample_count = sample_count;
+    warm.samples_since_snapshot = samples_since_snapshot;
+    warm.write_idx = accel_buf.write_idx;
+    warm.filled = accel_buf.filled;
+    warm.hop_samples = hop_samples;
+    warm.input_hz = input_hz;
+    warm.crc = warm_crc();
+    __set_PRIMASK(primask);
+}
+
+// the window's sums from scratch, once at boot
+static void window_sums(uint32_t *sum, uint32_t *wsum) {
+    const uint8_t *b = &accel_buf.data[0][0];
+    *sum = 0;
+    *wsum = 0;
+    for (uint32_t i = 0; i < sizeof(accel_buf.data); i++) {
+        *sum += b[i];
+        *wsum += b[i] * (i + 1);
+    }
+}
+
+// is what's in .noinit from before the reset, and all of it intact. A power
+// on or brownout means RAM's just noise, don't bother looking
+static bool warm_valid(void) {
+    bool cold = (RCC->CSR & (RCC_CSR_PORRSTF | RCC_CSR_BORRSTF)) != 0;
+    RCC->CSR |= RCC_CSR_RMVF;
+    if (cold || warm.magic != WARM_MAGIC || warm.crc != warm_crc()) {
+        return false;
+    }
+    if (warm.write_idx >= RING_SAMPLES || warm.filled > BUFFER_SIZE
+        || warm.hop_samples == 0 || warm.hop_samples > BUFFER_SIZE) {
+        return false;
+    }
+    uint32_t sum, wsum;
+    window_sums(&sum, &wsum);
+    return sum == warm.sum && wsum == warm.wsum;
+}
+#else
+static void warm_seal(void) {}
+#endif
+
+// sensor rate -> SAMPLE_RATE_HZ, a straight copy when they already match
+static Resampler resampler;
+
+// timing bookkeeping on the incoming (sensor rate) samples
+static SampleStats stats;
+static uint32_t input_period_us = 1000000 / SAMPLE_RATE_HZ;
+static uint32_t last_sample_us = 0;
+static bool have_last_sample = false;
+static const uint32_t jitter_bin_edges_us[JITTER_HIST_BINS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000
+};
+
+#if WORKOUT_USE_GYRO
+// gyro raw count -> input code, Q16 multiplier folded at compile time
+#define GYRO_QUANT_MULT_Q16 ((int32_t)(GYRO_DPS_PER_COUNT / GYRO_QUANT_SCALE * 65536.0f + 0.5f))
+
+// latest gyro codes, go in next to every accel sample stored until the next Workout_SetGyro
+static uint8_t gyro_codes[3] = {
+    GYRO_QUANT_ZERO ^ INPUT_CODE_FLIP, GYRO_QUANT_ZERO ^ INPUT_CODE_FLIP, GYRO_QUANT_ZERO ^ INPUT_CODE_FLIP
+};
+
+static uint8_t quantize_gyro(int16_t raw) {
+    int32_t q = ((raw * GYRO_QUANT_MULT_Q16 + (1 << 15)) >> 16) + GYRO_QUANT_ZERO;
+    if (q < 0) q = 0;
+    if (q > 255) q = 255;
+    return (uint8_t)q ^ INPUT_CODE_FLIP;
+}
+#endif
+
 static const char* workout_names[NUM_CLASSES] = {
     "WeightLift",
     "Walking",
@@ -39,20 +173,56 @@ static ai_handle network = AI_HANDLE_NULL;
 static ai_buffer *ai_input;
 static ai_buffer *ai_output;
 
-AI_ALIGNED(32)
-static ai_u8 input_data[BUFFER_SIZE * NUM_FEATURES];
+static volatile bool input_busy = false;   // the network's on a window, don't hand it another
+static volatile uint16_t samples_while_busy = 0;
 
 AI_ALIGNED(32)
 static ai_u8 output_data[NUM_CLASSES];
 
+#if WORKOUT_STREAMING
+static uint8_t stream_out[NUM_CLASSES];     // StreamNet_Classify at the last snapshot
+static uint32_t stream_cycles;
+static uint16_t stream_hops = 0;            // since the network last ran as a check
+static bool stream_check = false;           // run the network on this snapshot too
+#endif
+
 AI_ALIGNED(32) ai_u8 activations[AI_NETWORK_DATA_ACTIVATIONS_SIZE];
 
 // init ai network and buffers
 bool Workout_Init(void) {
     ai_error err;
 
+#if WORKOUT_WARM_RESTART
+    RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
+    warm_started = warm_valid();
+    if (warm_started) {
+        // carry on where we were, the first inference is at most a hop away
+        accel_buf.write_idx = warm.write_idx;
+        accel_buf.filled = warm.filled;
+        sample_count = warm.sample_count;
+        samples_since_snapshot = warm.samples_since_snapshot;
+        hop_samples = warm.hop_samples;
+        input_hz = warm.input_hz;
+    } else {
+        memset(&accel_buf, 0, sizeof(AccelBuffer));
+        warm.sum = 0;
+        warm.wsum = 0;
+        sample_count = 0;
+        warm_seal();
+    }
+#else
     memset(&accel_buf, 0, sizeof(AccelBuffer));
     sample_count = 0;
+#endif
+    Resampler_Init(&resampler, SAMPLE_RATE_HZ, SAMPLE_RATE_HZ);
+    Workout_ResetSampleStats();
+
+#ifndef HOST_BUILD
+    // cycle counter, times the network's run
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
 
     // Create the AI network
     err = ai_network_create(&network, AI_NETWORK_DATA_CONFIG);
@@ -80,90 +250,455 @@ bool Workout_Init(void) {
     ai_input = ai_network_inputs_get(network, NULL);
     ai_output = ai_network_outputs_get(network, NULL);
 
-    // Set up both
-    ai_input[0].data = AI_HANDLE_PTR(input_data);
+    if (AI_BUFFER_FMT_GET_SIGN(ai_input[0].format) != WORKOUT_INPUT_INT8) {
+        sendString("network input isn't what WORKOUT_INPUT_INT8 says \r\n");
+        return false;
+    }
+
+#if WORKOUT_STREAMING
+    if (!StreamNet_Init()) {
+        sendString("err on initing the streaming network \r\n");
+        return false;
+    }
+    // a warm start's window goes back through it, so it's ready when the window is
+    for (uint16_t i = 0; i < accel_buf.filled; i++) {
+        StreamNet_Push(accel_buf.data[(accel_buf.write_idx + RING_SAMPLES - accel_buf.filled + i) % RING_SAMPLES]);
+    }
+#endif
+
+#if WORKOUT_QUANT_CHECK
+    if (!Workout_CheckQuantizer()) {
+        sendString("block quantizer doesn't match the table, redo QUANT_SHIFT \r\n");
+        return false;
+    }
+#endif
+
+    // the input gets pointed into the window by Workout_Snapshot, or with
+    // WORKOUT_INPUT_IN_ACTIVATIONS stays where the runtime put it
     ai_output[0].data = AI_HANDLE_PTR(output_data);
 
     return true;
 }
 
-void Workout_AddSample(float x, float y, float z) {
-
-	// need to quantize the input
-	int16_t x_quant = (int16_t)((x / INPUT_QUANT_SCALE) + INPUT_QUANT_ZERO);
-	int16_t y_quant = (int16_t)((y / INPUT_QUANT_SCALE) + INPUT_QUANT_ZERO);
-	int16_t z_quant = (int16_t)((z / INPUT_QUANT_SCALE) + INPUT_QUANT_ZERO);
+// raw count -> input code, same math the float path used to do per sample:
+// g = raw * 8 / 2048, q = (int16)(g / scale + zero), clamped to 0..255, top bit
+// flipped for an int8 network. the compiler folds all of it, so the table is
+// flash and exact to the old float result
+#define QUANT_RAW(r)    ((int16_t)((((float)(r) * 8.0f) / 2048.0f) / INPUT_QUANT_SCALE + INPUT_QUANT_ZERO))
+#define QUANT_CODE(r)   (uint8_t)((QUANT_RAW(r) < 0 ? 0 : (QUANT_RAW(r) > 255 ? 255 : QUANT_RAW(r))) ^ INPUT_CODE_FLIP)
+#define QUANT_4(r)      QUANT_CODE(r), QUANT_CODE((r) + 1), QUANT_CODE((r) + 2), QUANT_CODE((r) + 3)
+#define QUANT_16(r)     QUANT_4(r), QUANT_4((r) + 4), QUANT_4((r) + 8), QUANT_4((r) + 12)
+#define QUANT_64(r)     QUANT_16(r), QUANT_16((r) + 16), QUANT_16((r) + 32), QUANT_16((r) + 48)
+#define QUANT_256(r)    QUANT_64(r), QUANT_64((r) + 64), QUANT_64((r) + 128), QUANT_64((r) + 192)
+#define QUANT_1024(r)   QUANT_256(r), QUANT_256((r) + 256), QUANT_256((r) + 512), QUANT_256((r) + 768)
+#define QUANT_4096(r)   QUANT_1024(r), QUANT_1024((r) + 1024), QUANT_1024((r) + 2048), QUANT_1024((r) + 3072)
+
+// indexed by raw - ACCEL_RAW_MIN, covers every 12-bit count
+static const uint8_t input_quant_lut[ACCEL_RAW_COUNT] = { QUANT_4096(ACCEL_RAW_MIN) };
+
+// the table's math in fixed point for Workout_QuantizeBlock: (raw * MULT + BIAS)
+// >> SHIFT, then saturated. 21 is the smallest shift that lands every 12-bit
+// count on the same code as the table (Workout_CheckQuantizer goes through
+// them all, redo it if the scale changes). An int8 network gets its codes
+// straight out of a signed saturate, that's the same as the flipped top bit
+#define QUANT_SHIFT     21
+#define QUANT_MULT      ((int32_t)(8.0f / 2048.0f / INPUT_QUANT_SCALE * (1 << QUANT_SHIFT) + 0.5f))
+#if WORKOUT_INPUT_INT8
+#define QUANT_BIAS      ((INPUT_QUANT_ZERO - 128) << QUANT_SHIFT)
+#define QUANT_SAT(v)    ((uint32_t)__SSAT((v), 8))
+#define QUANT_SAT16(v)  __SSAT16((v), 8)
+#else
+#define QUANT_BIAS      (INPUT_QUANT_ZERO << QUANT_SHIFT)
+#define QUANT_SAT(v)    __USAT((v), 8)
+#define QUANT_SAT16(v)  __USAT16((v), 8)
+#endif
+
+// one code into its slot(s) of the window, keeping the warm sums current
+static inline void put_code(uint8_t feature, uint8_t code) {
+    uint8_t *lo = &accel_buf.data[accel_buf.write_idx][feature];
+#if WORKOUT_WARM_RESTART
+    uint32_t off = (uint32_t)(lo - &accel_buf.data[0][0]);
+    uint32_t d_lo = (uint32_t)code - *lo;
+    warm.sum += d_lo;
+    warm.wsum += d_lo * (off + 1);
+#endif
+    *lo = code;
+
+#if !WORKOUT_INPUT_IN_ACTIVATIONS
+    uint8_t *hi = &accel_buf.data[accel_buf.write_idx + RING_SAMPLES][feature];
+#if WORKOUT_WARM_RESTART
+    uint32_t d_hi = (uint32_t)code - *hi;
+    warm.sum += d_hi;
+    warm.wsum += d_hi * (off + RING_SAMPLES * NUM_FEATURES + 1);
+#endif
+    *hi = code;
+#endif
+}
 
-	// clap to uint8 range
-	if (x_quant < 0) x_quant = 0;
-	if (x_quant > 255) x_quant = 255;
-	if (y_quant < 0) y_quant = 0;
-	if (y_quant > 255) y_quant = 255;
-	if (z_quant < 0) z_quant = 0;
-	if (z_quant > 255) z_quant = 255;
+// one sample's accel codes at the model's rate into the window
+RAMFUNC static void store_codes(const uint8_t codes[3]) {
+	put_code(0, codes[0]);
+	put_code(1, codes[1]);
+	put_code(2, codes[2]);
+#if WORKOUT_STREAMING
+	StreamNet_Push(codes);
+#endif
+#if WORKOUT_USE_GYRO
+	put_code(3, gyro_codes[0]);
+	put_code(4, gyro_codes[1]);
+	put_code(5, gyro_codes[2]);
+#endif
 
-	accel_buf.x[accel_buf.write_idx] = (uint8_t)x_quant;
-	accel_buf.y[accel_buf.write_idx] = (uint8_t)y_quant;
-	accel_buf.z[accel_buf.write_idx] = (uint8_t)z_quant;
+    sample_count++;
+    samples_since_snapshot++;
+    if (input_busy) {
+        samples_while_busy++;
+    }
 
     accel_buf.write_idx++;
-    if (accel_buf.write_idx >= BUFFER_SIZE) {
+    if (accel_buf.write_idx >= RING_SAMPLES) {
         accel_buf.write_idx = 0;
-        accel_buf.is_full = true;
     }
+    if (accel_buf.filled < BUFFER_SIZE && ++accel_buf.filled == BUFFER_SIZE) {
+        samples_since_snapshot = hop_samples;   // first hop's due the moment it fills
+    }
+    warm_seal();
+}
 
-    sample_count++;
+// one sample at the model's rate into the window
+static inline void store_sample(const AccelRawData *sample) {
+	// need to quantize the input, raw counts are always -2048..2047
+	const uint8_t codes[3] = {
+		input_quant_lut[sample->x - ACCEL_RAW_MIN],
+		input_quant_lut[sample->y - ACCEL_RAW_MIN],
+		input_quant_lut[sample->z - ACCEL_RAW_MIN]
+	};
+	store_codes(codes);
 }
 
-bool Workout_ShouldInfer(void) {
-    // Only infer if buffer is full, otherwise we don't have enough data
-    return accel_buf.is_full;
+// true if Workout_Init found the window from before a reset and kept it
+bool Workout_WarmStarted(void) {
+#if WORKOUT_WARM_RESTART
+    return warm_started;
+#else
+    return false;
+#endif
+}
+
+// tell us what rate the sensor is running at, the window always fills at SAMPLE_RATE_HZ.
+// old samples were at a different rate so the window starts over
+bool Workout_SetInputRate(uint16_t hz) {
+    if (!Resampler_Init(&resampler, hz, SAMPLE_RATE_HZ)) {
+        Resampler_Init(&resampler, SAMPLE_RATE_HZ, SAMPLE_RATE_HZ);
+        return false;
+    }
+    input_period_us = 1000000 / hz;
+    Workout_ResetSampleStats();
+#if WORKOUT_WARM_RESTART
+    // same rate as before the reset, the kept window still fits
+    if (warm_started && hz == input_hz) {
+        return true;
+    }
+    warm_started = false;
+#endif
+    input_hz = hz;
+    Workout_ResetBuffer();
+    return true;
+}
+
+// books the sample's timing, false if it's a repeat that shouldn't go in the window
+RAMFUNC static bool track_timing(const AccelRawData *sample) {
+    if (sample->flags & ACCEL_FLAG_REPEAT) {
+        stats.repeats++;
+        return false;
+    }
+    if (sample->flags & ACCEL_FLAG_OVERRUN) {
+        stats.overruns++;
+    }
+    // a lost sample still takes its slot in the window (held value), so the timing holds up
+    if (sample->flags & ACCEL_FLAG_LOST) {
+        stats.lost++;
+    } else {
+        stats.samples++;
+    }
+
+    if (have_last_sample) {
+        uint32_t interval = sample->t_us - last_sample_us;
+        int32_t jitter = (int32_t)(interval - input_period_us);
+
+        // anything past 1.5 periods means conversions went missing in between
+        if (interval > input_period_us + input_period_us / 2) {
+            stats.gap_missed += (interval + input_period_us / 2) / input_period_us - 1;
+        }
+        if (jitter < stats.jitter_min_us) stats.jitter_min_us = jitter;
+        if (jitter > stats.jitter_max_us) stats.jitter_max_us = jitter;
+
+        uint32_t mag = (jitter < 0) ? (uint32_t)(-jitter) : (uint32_t)jitter;
+        uint8_t bin = 0;
+        while (bin < JITTER_HIST_BINS - 1 && mag >= jitter_bin_edges_us[bin]) {
+            bin++;
+        }
+        stats.jitter_hist[bin]++;
+    }
+    last_sample_us = sample->t_us;
+    have_last_sample = true;
+    return true;
 }
 
-static void prepare_input_buffer(void) {
-    uint16_t read_idx = accel_buf.write_idx; // start from oldest sample
+void Workout_GetSampleStats(SampleStats *out) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = stats;
+    __set_PRIMASK(primask);
+}
 
-    // buffer shape is [200, 3]: [x0, y0, z0, x1, y1, z1, etc]
-    for (int t = 0; t < BUFFER_SIZE; t++) {
-        input_data[t * NUM_FEATURES + 0] = accel_buf.x[read_idx];
-        input_data[t * NUM_FEATURES + 1] = accel_buf.y[read_idx];
-        input_data[t * NUM_FEATURES + 2] = accel_buf.z[read_idx];
+void Workout_ResetSampleStats(void) {
+    memset(&stats, 0, sizeof(stats));
+    stats.jitter_min_us = INT32_MAX;
+    stats.jitter_max_us = INT32_MIN;
+    have_last_sample = false;
+}
+
+// gyro reading that goes with the next Workout_AddSample. If the accel is
+// resampled the same reading is held across every output it makes
+void Workout_SetGyro(const GyroRawData *gyro) {
+#if WORKOUT_USE_GYRO
+    gyro_codes[0] = quantize_gyro(gyro->x);
+    gyro_codes[1] = quantize_gyro(gyro->y);
+    gyro_codes[2] = quantize_gyro(gyro->z);
+#else
+    (void)gyro;
+#endif
+}
 
-        read_idx++;
-        if (read_idx >= BUFFER_SIZE) {
-            read_idx = 0;
+// one sample at the sensor's rate
+RAMFUNC void Workout_AddSample(const AccelRawData *sample) {
+    if (!track_timing(sample)) {
+        return;
+    }
+
+    AccelRawData out[RESAMPLER_MAX_OUT];
+    uint8_t n = Resampler_Push(&resampler, sample, out);
+    for (uint8_t i = 0; i < n; i++) {
+        store_sample(&out[i]);
+    }
+}
+
+// count samples' accel codes, same as the table gives: one multiply each, x
+// and y then sit in the two halves of a register for a single saturate
+RAMFUNC void Workout_QuantizeBlock(const AccelRawData *samples, uint8_t codes[][3], uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        int32_t x = (samples[i].x * QUANT_MULT + QUANT_BIAS) >> QUANT_SHIFT;
+        int32_t y = (samples[i].y * QUANT_MULT + QUANT_BIAS) >> QUANT_SHIFT;
+        int32_t z = (samples[i].z * QUANT_MULT + QUANT_BIAS) >> QUANT_SHIFT;
+
+        uint32_t xy = QUANT_SAT16(__PKHBT((uint32_t)x, (uint32_t)y, 16));
+        codes[i][0] = (uint8_t)xy;
+        codes[i][1] = (uint8_t)(xy >> 16);
+        codes[i][2] = (uint8_t)QUANT_SAT(z);
+    }
+}
+
+// every raw count through Workout_QuantizeBlock against the table, x going up
+// while y comes down
+bool Workout_CheckQuantizer(void) {
+    AccelRawData in[QUANT_BLOCK] = {0};
+    uint8_t codes[QUANT_BLOCK][3];
+
+    for (uint16_t base = 0; base < ACCEL_RAW_COUNT; base += QUANT_BLOCK) {
+        for (uint16_t i = 0; i < QUANT_BLOCK; i++) {
+            in[i].x = (int16_t)(ACCEL_RAW_MIN + base + i);
+            in[i].y = (int16_t)(ACCEL_RAW_MIN + ACCEL_RAW_COUNT - 1 - base - i);
+            in[i].z = in[i].x;
+        }
+        Workout_QuantizeBlock(in, codes, QUANT_BLOCK);
+        for (uint16_t i = 0; i < QUANT_BLOCK; i++) {
+            if (codes[i][0] != input_quant_lut[base + i]
+                    || codes[i][1] != input_quant_lut[ACCEL_RAW_COUNT - 1 - base - i]
+                    || codes[i][2] != input_quant_lut[base + i]) {
+                return false;
+            }
         }
     }
+    return true;
 }
 
-bool Workout_RunInference(WorkoutResult *result) {
-    if (network == AI_HANDLE_NULL || result == NULL) {
+// a burst of samples, oldest first (e.g. a FIFO drain). Already at the model's
+// rate they get quantized QUANT_BLOCK at a time, anything that has to be
+// resampled goes through one by one
+RAMFUNC void Workout_AddSamples(const AccelRawData *samples, uint16_t count) {
+    if (!resampler.bypass) {
+        for (uint16_t i = 0; i < count; i++) {
+            Workout_AddSample(&samples[i]);
+        }
+        return;
+    }
+
+    uint8_t codes[QUANT_BLOCK][3];
+    while (count) {
+        uint16_t n = (count < QUANT_BLOCK) ? count : QUANT_BLOCK;
+        Workout_QuantizeBlock(samples, codes, n);
+        for (uint16_t i = 0; i < n; i++) {
+            if (track_timing(&samples[i])) {
+                store_codes(codes[i]);
+            }
+        }
+        samples += n;
+        count -= n;
+    }
+}
+
+// hop in ms, rounded down to whole samples. Takes effect from the next hop.
+// Streaming only takes whole max-pool blocks
+bool Workout_SetHop(uint16_t ms) {
+    if (ms < HOP_MIN_MS || ms > HOP_MAX_MS) {
         return false;
     }
+    if ((ms * SAMPLE_RATE_HZ / 1000) % HOP_STEP_SAMPLES) {
+        return false;
+    }
+    hop_samples = ms * SAMPLE_RATE_HZ / 1000;
+    warm_seal();
+    return true;
+}
+
+uint16_t Workout_GetHopMs(void) {
+    return hop_samples * 1000 / SAMPLE_RATE_HZ;
+}
+
+bool Workout_ShouldInfer(void) {
+    // Only infer if buffer is full, otherwise we don't have enough data,
+    // and then once every hop. Streaming waits for the window to start on a
+    // pool block, only a burst of samples can go past one
+    return accel_buf.filled >= BUFFER_SIZE && samples_since_snapshot >= hop_samples
+#if WORKOUT_STREAMING
+        && StreamNet_Ready()
+#endif
+        ;
+}
+
+// hands the network the newest BUFFER_SIZE samples. Called from the same
+// context that adds samples so it's one consistent 2s of data. Mirrored, the
+// input just gets pointed at them and they stay put until RING_SLACK more
+// samples have come in. Otherwise the ring goes into the runtime's own input
+// tensor, oldest first, in two straight copies. false if the network's still
+// on the last one, the window carries on either way
+bool Workout_Snapshot(void) {
+    if (input_busy) {
+        return false;
+    }
+#if WORKOUT_INPUT_IN_ACTIVATIONS
+    uint16_t older = RING_SAMPLES - accel_buf.write_idx;
+    ai_u8 *in = (ai_u8 *)ai_input[0].data;
+    memcpy(in, accel_buf.data[accel_buf.write_idx], older * NUM_FEATURES);
+    memcpy(in + older * NUM_FEATURES, accel_buf.data[0], accel_buf.write_idx * NUM_FEATURES);
+#else
+    // the newest sample went in at write_idx - 1 + RING_SAMPLES, the oldest
+    // one of the window is BUFFER_SIZE - 1 before that
+    ai_input[0].data = AI_HANDLE_PTR(accel_buf.data[accel_buf.write_idx + RING_SLACK]);
+#endif
+    samples_while_busy = 0;
+    input_busy = true;
+
+#if WORKOUT_STREAMING
+    // the whole classification, it's cheap enough for this context
+#ifndef HOST_BUILD
+    uint32_t start = DWT->CYCCNT;
+#endif
+    StreamNet_Classify(stream_out);
+#ifndef HOST_BUILD
+    stream_cycles = DWT->CYCCNT - start;
+#endif
+    stream_check = WORKOUT_STREAM_CHECK_HOPS && ++stream_hops >= WORKOUT_STREAM_CHECK_HOPS;
+    if (stream_check) {
+        stream_hops = 0;
+    }
+#endif
+
+    // anything past the first hop went by while the last one was running
+    stats.hops_skipped += samples_since_snapshot / hop_samples - 1;
+    samples_since_snapshot = 0;
+    warm_seal();
+    return true;
+}
 
-    // prep input data from circular buffer
-    prepare_input_buffer();
+// whether Workout_RunInference is going to run the network on the last
+// snapshot, streaming mostly has its result already
+bool Workout_NetworkDue(void) {
+#if WORKOUT_STREAMING
+    return stream_check;
+#else
+    return true;
+#endif
+}
+
+// runs the network on the last Workout_Snapshot, fine to be preempted by
+// whoever is adding samples
+bool Workout_RunInference(WorkoutResult *result) {
+    if (network == AI_HANDLE_NULL || result == NULL || !input_busy) {
+        return false;
+    }
 
-    // do inference
-    ai_i32 batch = ai_network_run(network, ai_input, ai_output);
+    // do inference. Streaming already has its result, the network only runs
+    // now and then to check it
+#if WORKOUT_STREAMING
+    bool run_network = stream_check;
+#else
+    bool run_network = true;
+#endif
+    ai_i32 batch = 1;
+#ifndef HOST_BUILD
+    uint32_t start = DWT->CYCCNT;
+#endif
+    if (run_network) {
+        batch = ai_network_run(network, ai_input, ai_output);
+    }
+#ifndef HOST_BUILD
+    result->inference_cycles = DWT->CYCCNT - start;   // anything that preempted it included
+#else
+    result->inference_cycles = 0;
+#endif
+    // the run got preempted for long enough that new samples started landing
+    // on the window it was reading. Copied into the activations it can't happen
+#if !WORKOUT_INPUT_IN_ACTIVATIONS
+    bool overrun = samples_while_busy >= RING_SLACK;
+#else
+    bool overrun = false;
+#endif
+    input_busy = false;
+    if (overrun) {
+        stats.windows_overrun++;
+        return false;
+    }
     if (batch != 1) {
         return false; // fail
     }
 
+    const ai_u8 *scores = (ai_u8*)ai_output[0].data;
+#if WORKOUT_STREAMING
+    if (run_network) {
+        stats.stream_checks++;
+        if (memcmp(stream_out, scores, NUM_CLASSES) != 0) {
+            stats.stream_mismatches++;
+        }
+    }
+    scores = stream_out;
+    result->inference_cycles = stream_cycles;
+#endif
+
     // Dequantize output: val = (quantized - zero_point) * scale
     float dequantized_output[NUM_CLASSES];
-    ai_u8 *output_uint8 = (ai_u8*)ai_output[0].data;
     for (int i = 0; i < NUM_CLASSES; i++) {
-    	dequantized_output[i] = ((float)output_uint8[i] - OUTPUT_QUANT_ZERO) * OUTPUT_QUANT_SCALE;
+    	dequantized_output[i] = ((float)scores[i] - OUTPUT_QUANT_ZERO) * OUTPUT_QUANT_SCALE;
     }
 
     // Process output (softmax probabilities, want to find highest)
     int max_idx = 0;
-    float max_val = output_data[0];
+    float max_val = scores[0];
 
     for (int i = 1; i < NUM_CLASSES; i++) {
-        if (output_data[i] > max_val) {
-            max_val = output_data[i];
+        if (scores[i] > max_val) {
+            max_val = scores[i];
             max_idx = i;
         }
     }
@@ -173,7 +708,7 @@ bool Workout_RunInference(WorkoutResult *result) {
     result->inference_time_ms = 0;
     result->timestamp = sample_count;
     for (int i = 0; i < NUM_CLASSES; i++) {
-        result->class_scores[i] = output_data[i] / 10.0f;
+        result->class_scores[i] = scores[i] / 10.0f;
     }
 
     return true;
@@ -187,7 +722,13 @@ const char* Workout_GetName(WorkoutClass cls) {
     return "Unknown";
 }
 
+// write_idx stays where it is, so a window the network might still be on
+// doesn't get written over any sooner than it would have been
 void Workout_ResetBuffer(void) {
-    accel_buf.write_idx = 0;
-    accel_buf.is_full = false;
+    accel_buf.filled = 0;
+    samples_since_snapshot = 0;
+#if WORKOUT_STREAMING
+    StreamNet_Reset();
+#endif
+    warm_seal();
 }